@@ -1,3 +1,5 @@
+import struct
+
 import requests
 from flask import current_app as app
 
@@ -14,12 +16,12 @@ def resolve(url):
 
 
 def neighbour(embedding):
-    data = ','.join([str(e) for e in embedding])
+    data = struct.pack('<{}f'.format(len(embedding)), *embedding)
     url = resolve('neighbour')
     print(url, file=sys.stdout)
 
     try:
-        response = requests.post(url, data=data, headers={'content-type': 'text/plain'})
+        response = requests.post(url, data=data, headers={'content-type': 'application/octet-stream'})
         if response.status_code != requests.codes.ok:
             print('Not ok index response status: {}'.format(response.content), file=sys.stderr)
             return
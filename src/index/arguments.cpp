@@ -5,6 +5,7 @@
 #include <vector>
 #include <exception>
 #include <stdexcept>
+#include <cmath>
 #include <iostream>
 
 #include "arguments.h"
@@ -27,8 +28,11 @@ const std::vector<Arguments::Param> Arguments::params = {
 	Param("--efSearch", "-eS", "count of tracked nearest nodes during search",
 		[](const Arguments &args, const std::string &value) {args.indexSettings.efSearch = args.positive(std::stoi(value));}),
 
+	Param("--maxEfSearch", "upper bound for k and ef in search requests",
+		[](const Arguments &args, const std::string &value) {args.indexSettings.maxEfSearch = args.positive(std::stoi(value));}),
+
 	Param("--mL", "prefactor for random level generation",
-		[](const Arguments &args, const std::string &value) {args.indexSettings.mL = args.positiveOrZero(std::stod(value));}),
+		[](const Arguments &args, const std::string &value) {args.indexSettings.mL = args.positive(args.finite(std::stod(value)));}),
 
 	Param("--keepPrunedConnections", "-k", "keep constant number of nodes neighbours",
 		[](const Arguments &args, const std::string &value) {args.indexSettings.keepPrunedConnections = std::stoi(value);}),
@@ -39,12 +43,39 @@ const std::vector<Arguments::Param> Arguments::params = {
 	Param("--dump", "-dm", "path to file with index dump",
 		[](const Arguments &args, const std::string &value) {args.dumpPath = args.notEmpty(value);}),
 
+	Param("--convert", "-c", "path to text dump, that will be converted to binary dump at --dump path",
+		[](const Arguments &args, const std::string &value) {args.convertPath = args.notEmpty(value);}),
+
 	Param("--dataset", "-ds", "path to dataset directory",
 		[](const Arguments &args, const std::string &value) {args.dataset = args.notEmpty(value); }),
 
+	Param("--imageCache", "-ic", "megabytes of dataset images, that are kept mapped for responses, 0 disables caching",
+		[](const Arguments &args, const std::string &value) {args.imageCacheSize = args.positiveOrZero(std::stoi(value));}),
+
+	Param("--searchCache", "-sc", "megabytes of cached search results, 0 disables caching",
+		[](const Arguments &args, const std::string &value) {args.searchCacheSize = args.positiveOrZero(std::stoi(value));}),
+
+	Param("--searchCacheStep", "quantization step of descriptor values in search cache keys",
+		[](const Arguments &args, const std::string &value) {args.searchCacheStep = args.positive(args.finite(std::stod(value)));}),
+
 	Param("--base", "-b", "count of object, that will be inserted sequentially",
 		[](const Arguments &args, const std::string &value) {args.baseSize = args.positiveOrZero(std::stoi(value));}),
 
+	Param("--shards", "-sh", "count of independent index shards, searches run on all of them",
+		[](const Arguments &args, const std::string &value) {args.shardsCount = args.positive(std::stoi(value));}),
+
+	Param("--syncInterval", "-si", "milliseconds, that insert log waits to sync inserts together",
+		[](const Arguments &args, const std::string &value) {args.syncInterval = args.positiveOrZero(std::stoi(value));}),
+
+	Param("--snapshotInterval", "-sn", "seconds between dump snapshots and graph repairs with online changes, 0 disables both",
+		[](const Arguments &args, const std::string &value) {args.snapshotInterval = args.positiveOrZero(std::stoi(value));}),
+
+	Param("--shardServers", "-ss", "comma-separated host:port addresses of shard servers, the index runs as their coordinator",
+		[](const Arguments &args, const std::string &value) {args.shardServers = args.split(args.notEmpty(value));}),
+
+	Param("--shardTimeout", "-st", "milliseconds, that coordinator waits for the whole request to a shard server",
+		[](const Arguments &args, const std::string &value) {args.shardTimeout = args.positive(std::stoi(value));}),
+
 	Param("--address", "-a", "address, that web-server is hosted on",
 		[](const Arguments &args, const std::string &value) {args.address = args.notEmpty(value);}),
 
@@ -54,7 +85,7 @@ const std::vector<Arguments::Param> Arguments::params = {
 
 template<class T>
 T Arguments::positive(T value) const {
-	if (value <= 0) {
+	if (!(value > 0)) {
 		throw std::runtime_error("value should be positive");
 	}
 
@@ -63,13 +94,21 @@ T Arguments::positive(T value) const {
 
 template<class T>
 T Arguments::positiveOrZero(T value) const {
-	if (value < 0) {
+	if (!(value >= 0)) {
 		throw std::runtime_error("value should be positive or zero");
 	}
 
 	return value;
 }
 
+double Arguments::finite(double value) const {
+	if (!std::isfinite(value)) {
+		throw std::runtime_error("value should be finite");
+	}
+
+	return value;
+}
+
 std::string Arguments::notEmpty(std::string value) const {
 	if (value.empty()) {
 		throw std::runtime_error("value shouldn't be empty");
@@ -78,6 +117,18 @@ std::string Arguments::notEmpty(std::string value) const {
 	return value;
 }
 
+std::vector<std::string> Arguments::split(const std::string &value) const {
+	std::vector<std::string> items;
+	std::istringstream stream(value);
+	std::string item;
+
+	while (std::getline(stream, item, ',')) {
+		items.push_back(notEmpty(item));
+	}
+
+	return items;
+}
+
 Arguments::Arguments(int argc, char **argv) {
 	for (int i = 1; i < argc; ++i) {
 		std::istringstream argStream(argv[i]);
@@ -2,6 +2,7 @@
 #define ARGUMENTS_H
 
 #include <string>
+#include <vector>
 #include <functional>
 #include <iostream>
 #include <iomanip>
@@ -20,14 +21,25 @@ class Arguments {
 	template<class T>
 	T positiveOrZero(T value) const;
 
+	double finite(double value) const;
 	std::string notEmpty(std::string value) const;
+	std::vector<std::string> split(const std::string &value) const;
 
 public:
 	mutable Settings indexSettings;
 	mutable std::string dataPath = "index.data";
 	mutable std::string dumpPath = "index.dump";
+	mutable std::string convertPath;
 	mutable std::string dataset = "./";
+	mutable int imageCacheSize = 256;
+	mutable int searchCacheSize = 0;
+	mutable double searchCacheStep = 0.001;
 	mutable int baseSize = 1000;
+	mutable int shardsCount = 1;
+	mutable int syncInterval = 10;
+	mutable int snapshotInterval = 600;
+	mutable std::vector<std::string> shardServers;
+	mutable int shardTimeout = 1000;
 	mutable std::string address = "127.0.0.1";
 	mutable int port = 8000;
 
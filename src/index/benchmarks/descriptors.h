@@ -0,0 +1,37 @@
+#ifndef BENCHMARKS_DESCRIPTORS_H
+#define BENCHMARKS_DESCRIPTORS_H
+
+#include <vector>
+#include <random>
+
+#include "../index.h"
+
+// Generates descriptors of benchmarks. Without centers values are uniform in [0, 1), otherwise descriptors lie
+// around randomly picked centers, so searches have to tell near clusters apart. Centers are generated uniform.
+inline std::vector<std::vector<Scalar>> generateDescriptors(int count, int descriptorSize,
+	const std::vector<std::vector<Scalar>> &centers, std::mt19937 &gen) {
+	std::uniform_real_distribution<float> uniform(0, 1);
+	std::normal_distribution<float> normal(0, 0.05f);
+	std::uniform_int_distribution<int> centerDist(0, centers.empty() ? 0 : centers.size() - 1);
+	std::vector<std::vector<Scalar>> descriptors(count, std::vector<Scalar>(descriptorSize));
+
+	for (std::vector<Scalar> &descriptor : descriptors) {
+		if (centers.empty()) {
+			for (Scalar &value : descriptor) {
+				value = uniform(gen);
+			}
+
+			continue;
+		}
+
+		const std::vector<Scalar> &center = centers[centerDist(gen)];
+
+		for (int i = 0; i < descriptorSize; ++i) {
+			descriptor[i] = center[i] + normal(gen);
+		}
+	}
+
+	return descriptors;
+}
+
+#endif
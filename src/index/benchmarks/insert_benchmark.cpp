@@ -0,0 +1,174 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../index.h"
+#include "../thread_pool.h"
+#include "descriptors.h"
+
+// Insert throughput and search latency of an index, that takes inserts while serving searches, as with /insert.
+// Searches run alone, inserts run alone, then both run at once on a copy of the same base.
+// Usage: insert_benchmark [descriptor size] [base size] [inserted count] [insert threads] [search threads]
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	int descriptorSize = 128;
+	int baseSize = 20000;
+	int insertedCount = 20000;
+	int insertThreads = 2;
+	int searchThreads = 2;
+};
+
+struct SearchStats {
+	long long count = 0;
+	double seconds = 0;
+	std::vector<double> latencies;
+};
+
+static void buildBase(Index &index, const std::vector<std::vector<Scalar>> &base) {
+	ThreadPool pool;
+
+	index.insert("base0", base.front());
+
+	pool.parallelFor(base.size() - 1, [&](int begin, int end) {
+		for (int i = begin + 1; i < end + 1; ++i) {
+			index.insert("base" + std::to_string(i), base[i]);
+		}
+	});
+}
+
+// Inserts all descriptors by threadsCount threads, returns seconds.
+static double runInserts(Index &index, const std::vector<std::vector<Scalar>> &inserted, int threadsCount) {
+	std::atomic<int> next{0};
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+
+	for (int t = 0; t < threadsCount; ++t) {
+		threads.emplace_back([&]() {
+			for (int i = next++; i < inserted.size(); i = next++) {
+				index.insert("new" + std::to_string(i), inserted[i]);
+			}
+		});
+	}
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Searches by threadsCount threads, until stop is set, at least minCount queries in total.
+static SearchStats runSearches(Index &index, const std::vector<std::vector<Scalar>> &queries, int threadsCount, const std::atomic<bool> &stop, long long minCount) {
+	std::atomic<long long> count{0};
+	std::vector<std::vector<double>> latencies(threadsCount);
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+
+	for (int t = 0; t < threadsCount; ++t) {
+		threads.emplace_back([&, t]() {
+			for (long long i = t; !stop || count < minCount; i += threadsCount) {
+				Clock::time_point queryStart = Clock::now();
+				index.search(queries[i % queries.size()], SearchParams(10));
+				latencies[t].push_back(std::chrono::duration<double, std::micro>(Clock::now() - queryStart).count());
+				++count;
+			}
+		});
+	}
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	SearchStats stats;
+	stats.count = count;
+	stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	for (const std::vector<double> &threadLatencies : latencies) {
+		stats.latencies.insert(stats.latencies.end(), threadLatencies.begin(), threadLatencies.end());
+	}
+
+	return stats;
+}
+
+static double percentile(std::vector<double> &values, double fraction) {
+	std::size_t position = std::min(values.size() - 1, static_cast<std::size_t>(fraction * values.size()));
+	std::nth_element(values.begin(), values.begin() + position, values.end());
+
+	return values[position];
+}
+
+static void printSearches(const char *name, SearchStats &stats) {
+	std::printf("%-22s %9.0f queries/s, p50 %8.1f us, p99 %8.1f us\n", name, stats.count / stats.seconds,
+		percentile(stats.latencies, 0.5), percentile(stats.latencies, 0.99));
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	int *values[] = {&options.descriptorSize, &options.baseSize, &options.insertedCount, &options.insertThreads, &options.searchThreads};
+
+	for (int i = 1; i < argc && i <= 5; ++i) {
+		*values[i - 1] = std::atoi(argv[i]);
+
+		if (*values[i - 1] < 1) {
+			std::cerr << "Usage: insert_benchmark [descriptor size] [base size] [inserted count] [insert threads] [search threads]" << std::endl;
+			return 1;
+		}
+	}
+
+	// Base, inserted images and queries lie around the same clusters.
+	std::mt19937 gen(1);
+	std::vector<std::vector<Scalar>> centers = generateDescriptors(100, options.descriptorSize, {}, gen);
+	std::vector<std::vector<Scalar>> base = generateDescriptors(options.baseSize, options.descriptorSize, centers, gen);
+	std::vector<std::vector<Scalar>> inserted = generateDescriptors(options.insertedCount, options.descriptorSize, centers, gen);
+	std::vector<std::vector<Scalar>> queries = generateDescriptors(1000, options.descriptorSize, centers, gen);
+
+	std::printf("%d-d, base %d, inserted %d, %d insert threads, %d search threads, %u hardware threads\n",
+		options.descriptorSize, options.baseSize, options.insertedCount, options.insertThreads, options.searchThreads,
+		std::thread::hardware_concurrency());
+
+	Index searchIndex(options.descriptorSize);
+	buildBase(searchIndex, base);
+
+	std::atomic<bool> stop{true};
+	SearchStats searchOnly = runSearches(searchIndex, queries, options.searchThreads, stop, 20000);
+	printSearches("searches only", searchOnly);
+
+	Index insertIndex(options.descriptorSize);
+	buildBase(insertIndex, base);
+
+	double insertSeconds = runInserts(insertIndex, inserted, options.insertThreads);
+	std::printf("%-22s %9.0f inserts/s\n", "inserts only", inserted.size() / insertSeconds);
+
+	Index mixedIndex(options.descriptorSize);
+	buildBase(mixedIndex, base);
+
+	stop = false;
+	SearchStats mixed;
+
+	std::thread searcher([&]() {
+		mixed = runSearches(mixedIndex, queries, options.searchThreads, stop, 0);
+	});
+
+	double mixedSeconds = runInserts(mixedIndex, inserted, options.insertThreads);
+	stop = true;
+	searcher.join();
+
+	std::printf("%-22s %9.0f inserts/s\n", "mixed: inserts", inserted.size() / mixedSeconds);
+	printSearches("mixed: searches", mixed);
+
+	if (mixedIndex.getSize() != options.baseSize + options.insertedCount) {
+		std::cerr << "Index has " << mixedIndex.getSize() << " nodes instead of " << options.baseSize + options.insertedCount << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
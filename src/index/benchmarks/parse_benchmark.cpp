@@ -0,0 +1,114 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "../parser.h"
+
+// Time and heap allocations of parsing a /neighbour request body: the stream parser of older versions
+// against FieldReader, which reads values in place.
+// Usage: parse_benchmark [descriptor size] [requests count]
+
+static std::atomic<long long> allocationsCount{0};
+
+void* operator new(std::size_t size) {
+	++allocationsCount;
+
+	if (void *memory = std::malloc(size ? size : 1)) {
+		return memory;
+	}
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+	std::free(memory);
+}
+
+static std::vector<Scalar> parseStream(std::istream &in, int descriptorSize) {
+	std::vector<Scalar> descriptor;
+	descriptor.reserve(descriptorSize);
+	std::string item;
+
+	try {
+		while (getline(in, item, ',')) {
+			descriptor.push_back(static_cast<Scalar>(std::stod(item)));
+		}
+	} catch (const std::invalid_argument&) {
+		throw std::runtime_error("Invalid value");
+	} catch (const std::out_of_range&) {
+		throw std::runtime_error("Value is out of range");
+	}
+
+	if (descriptor.size() != descriptorSize) {
+		throw std::runtime_error("Incorrect descriptor size");
+	}
+
+	return descriptor;
+}
+
+template<class Parse>
+static void measure(const std::string &name, const std::vector<std::string> &bodies, const Parse &parse, std::vector<std::vector<Scalar>> &results) {
+	long long allocationsBefore = allocationsCount;
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < bodies.size(); ++i) {
+		results[i] = parse(bodies[i]);
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double allocations = static_cast<double>(allocationsCount - allocationsBefore) / bodies.size();
+
+	std::printf("%-12s %8.2f us per request, %6.1f allocations per request\n", name.c_str(), seconds * 1e6 / bodies.size(), allocations);
+}
+
+int main(int argc, char **argv) {
+	int descriptorSize = argc > 1 ? std::atoi(argv[1]) : 128;
+	int requestsCount = argc > 2 ? std::atoi(argv[2]) : 20000;
+
+	std::mt19937 gen(1);
+	std::normal_distribution<float> dist(0, 0.1f);
+	std::vector<std::string> bodies(requestsCount);
+
+	for (std::string &body : bodies) {
+		char value[32];
+
+		for (int i = 0; i < descriptorSize; ++i) {
+			std::snprintf(value, sizeof(value), i > 0 ? ",%.7g" : "%.7g", dist(gen));
+			body += value;
+		}
+	}
+
+	std::vector<std::vector<Scalar>> streamResults(requestsCount);
+	std::vector<std::vector<Scalar>> readerResults(requestsCount);
+
+	for (int round = 0; round < 3; ++round) {
+		measure("stream", bodies, [descriptorSize](const std::string &body) {
+			std::istringstream in(body);
+			return parseStream(in, descriptorSize);
+		}, streamResults);
+
+		measure("FieldReader", bodies, [descriptorSize](const std::string &body) {
+			FieldReader reader(body.data(), body.data() + body.size());
+			return parseDescriptor(reader, descriptorSize);
+		}, readerResults);
+	}
+
+	if (streamResults != readerResults) {
+		std::cerr << "Parsers returned different descriptors" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../index.h"
+#include "../thread_pool.h"
+#include "descriptors.h"
+
+// Single thread search latency on a dump. A missing dump is built from clustered descriptors and saved first,
+// so later runs, also of other versions, search the same graph. Queries are drawn around the same cluster centers.
+// The results hash is the same for versions, which find the same nodes.
+// Usage: search_benchmark <dump> [ef] [k] [nodes count] [descriptor size]
+
+using Clock = std::chrono::steady_clock;
+
+static const int centersCount = 1000;
+static const int queriesCount = 20000;
+static const int roundsCount = 5;
+
+static std::vector<std::vector<Scalar>> generateCenters(int descriptorSize) {
+	std::mt19937 gen(1);
+	return generateDescriptors(centersCount, descriptorSize, {}, gen);
+}
+
+static void buildDump(const std::string &path, int nodesCount, const std::vector<std::vector<Scalar>> &centers) {
+	std::mt19937 gen(2);
+	std::vector<std::vector<Scalar>> data = generateDescriptors(nodesCount, centers.front().size(), centers, gen);
+
+	Index index(centers.front().size());
+	ThreadPool pool;
+
+	index.insert("0", data.front());
+
+	pool.parallelFor(nodesCount - 1, [&](int begin, int end) {
+		for (int i = begin + 1; i < end + 1; ++i) {
+			index.insert(std::to_string(i), data[i]);
+		}
+	});
+
+	index.save(path);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: search_benchmark <dump> [ef] [k] [nodes count] [descriptor size]" << std::endl;
+		return 1;
+	}
+
+	std::string path = argv[1];
+	int ef = argc > 2 ? std::atoi(argv[2]) : 64;
+	int k = argc > 3 ? std::atoi(argv[3]) : 10;
+	int nodesCount = argc > 4 ? std::atoi(argv[4]) : 500000;
+	int descriptorSize = argc > 5 ? std::atoi(argv[5]) : 96;
+
+	if (!std::ifstream(path).good()) {
+		std::cout << "Building " << nodesCount << " nodes of size " << descriptorSize << " into " << path << std::endl;
+		buildDump(path, nodesCount, generateCenters(descriptorSize));
+	}
+
+	Settings settings;
+	settings.maxEfSearch = std::max(settings.maxEfSearch, ef);
+
+	Index index(path, settings);
+	descriptorSize = index.getDescriptorSize();
+
+	std::mt19937 gen(3);
+	std::vector<std::vector<Scalar>> queries = generateDescriptors(queriesCount, descriptorSize, generateCenters(descriptorSize), gen);
+	std::vector<double> latencies(queriesCount);
+
+	std::printf("%d nodes of size %d, ef %d, k %d, %d queries per round\n", index.getSize(), descriptorSize, ef, k, queriesCount);
+
+	for (int round = 0; round < roundsCount; ++round) {
+		std::size_t hash = 0;
+		Clock::time_point start = Clock::now();
+
+		for (int i = 0; i < queriesCount; ++i) {
+			Clock::time_point queryStart = Clock::now();
+			std::vector<SearchResult> results = index.search(queries[i], SearchParams(k, ef));
+			latencies[i] = std::chrono::duration<double, std::micro>(Clock::now() - queryStart).count();
+
+			for (const SearchResult &result : results) {
+				hash = hash * 31 + std::hash<std::string>()(result.name);
+			}
+		}
+
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		double mean = seconds * 1e6 / queriesCount;
+
+		std::sort(latencies.begin(), latencies.end());
+
+		std::printf("round %d: %8.0f queries/s, mean %7.1f us, p50 %7.1f us, p99 %7.1f us, results hash %016zx\n",
+			round, queriesCount / seconds, mean, latencies[queriesCount / 2], latencies[queriesCount * 99 / 100], hash);
+	}
+
+	return 0;
+}
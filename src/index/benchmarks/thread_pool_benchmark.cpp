@@ -0,0 +1,166 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../index.h"
+#include "../thread_pool.h"
+#include "descriptors.h"
+
+// Insert throughput of ThreadPool at 4, 16 and 64 threads against the pool of older versions:
+// one std::function task per item in a queue behind a single mutex. Empty tasks show the scheduling cost alone.
+// Usage: thread_pool_benchmark [descriptor size] [inserted count]
+
+using Clock = std::chrono::steady_clock;
+
+class QueuePool {
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+
+	bool isRunning = true;
+	int working = 0;
+
+	std::mutex mutex;
+	std::condition_variable taskCV;
+	std::condition_variable doneCV;
+
+public:
+	QueuePool(int threadCount) {
+		for (int i = 0; i < threadCount; ++i) {
+			workers.emplace_back([this]() {
+				std::unique_lock<std::mutex> lock(mutex);
+
+				while (true) {
+					taskCV.wait(lock, [this]() {
+						return !isRunning || !tasks.empty();
+					});
+
+					if (!isRunning) {
+						break;
+					}
+
+					std::function<void()> task = std::move(tasks.front());
+					tasks.pop();
+					++working;
+
+					lock.unlock();
+					task();
+					lock.lock();
+
+					--working;
+					doneCV.notify_all();
+				}
+			});
+		}
+	}
+
+	~QueuePool() {
+		std::unique_lock<std::mutex> lock(mutex);
+		isRunning = false;
+		lock.unlock();
+
+		taskCV.notify_all();
+
+		for (std::thread &worker : workers) {
+			worker.join();
+		}
+	}
+
+	void enqueue(std::function<void()> task) {
+		std::unique_lock<std::mutex> lock(mutex);
+		tasks.push(std::move(task));
+		lock.unlock();
+
+		taskCV.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCV.wait(lock, [this]() {
+			return tasks.empty() && working == 0;
+		});
+	}
+};
+
+// Runs action for each of count items by the pool, returns items per second.
+static double runQueuePool(int threadCount, int count, const std::function<void(int)> &action) {
+	QueuePool pool(threadCount);
+	Clock::time_point start = Clock::now();
+
+	for (int i = 0; i < count; ++i) {
+		pool.enqueue([&action, i]() {
+			action(i);
+		});
+	}
+
+	pool.wait();
+
+	return count / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double runThreadPool(int threadCount, int count, const std::function<void(int)> &action) {
+	ThreadPool pool(threadCount);
+	Clock::time_point start = Clock::now();
+
+	pool.parallelFor(count, [&action](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			action(i);
+		}
+	});
+
+	return count / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+	int descriptorSize = argc > 1 ? std::atoi(argv[1]) : 128;
+	int insertedCount = argc > 2 ? std::atoi(argv[2]) : 20000;
+	const int baseSize = 1000;
+	const int emptyCount = 1000000;
+
+	if (descriptorSize < 1 || insertedCount < 1) {
+		std::cerr << "Usage: thread_pool_benchmark [descriptor size] [inserted count]" << std::endl;
+		return 1;
+	}
+
+	std::mt19937 gen(1);
+	std::vector<std::vector<Scalar>> base = generateDescriptors(baseSize, descriptorSize, {}, gen);
+	std::vector<std::vector<Scalar>> inserted = generateDescriptors(insertedCount, descriptorSize, {}, gen);
+
+	std::printf("%d-d, base %d, inserted %d, %u hardware threads\n", descriptorSize, baseSize, insertedCount, std::thread::hardware_concurrency());
+	std::printf("%-8s %-12s %14s %18s\n", "threads", "pool", "inserts/s", "empty tasks/s");
+
+	for (int threadCount : {4, 16, 64}) {
+		for (bool queue : {true, false}) {
+			auto run = queue ? runQueuePool : runThreadPool;
+
+			Index index(descriptorSize);
+
+			for (int i = 0; i < baseSize; ++i) {
+				index.insert("base" + std::to_string(i), base[i]);
+			}
+
+			double inserts = run(threadCount, insertedCount, [&](int i) {
+				index.insert("new" + std::to_string(i), inserted[i]);
+			});
+
+			double emptyTasks = run(threadCount, emptyCount, [](int) {});
+
+			if (index.getSize() != baseSize + insertedCount) {
+				std::cerr << "Index has " << index.getSize() << " nodes instead of " << baseSize + insertedCount << std::endl;
+				return 1;
+			}
+
+			std::printf("%-8d %-12s %14.0f %18.0f\n", threadCount, queue ? "queue" : "ThreadPool", inserts, emptyTasks);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+#include <cstddef>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+
+// Blocking FIFO between pipeline stages. Producers wait while it's full, so a fast stage can't run far ahead.
+template<class T>
+class BoundedQueue {
+	std::deque<T> items;
+	std::size_t capacity;
+	bool isClosed = false;
+
+	std::mutex mutex;
+	std::condition_variable pushCV;
+	std::condition_variable popCV;
+
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// Returns false if the queue is closed, the item is dropped then.
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		pushCV.wait(lock, [this]() {
+			return items.size() < capacity || isClosed;
+		});
+
+		if (isClosed) {
+			return false;
+		}
+
+		items.push_back(std::move(item));
+		lock.unlock();
+
+		popCV.notify_one();
+		return true;
+	}
+
+	// Returns false once the queue is closed and all items are taken.
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		popCV.wait(lock, [this]() {
+			return !items.empty() || isClosed;
+		});
+
+		if (items.empty()) {
+			return false;
+		}
+
+		item = std::move(items.front());
+		items.pop_front();
+		lock.unlock();
+
+		pushCV.notify_one();
+		return true;
+	}
+
+	// Wakes all waiting threads. Further pushes fail, pops take the remaining items.
+	void close() {
+		std::unique_lock<std::mutex> lock(mutex);
+		isClosed = true;
+		lock.unlock();
+
+		pushCV.notify_all();
+		popCV.notify_all();
+	}
+};
+
+#endif
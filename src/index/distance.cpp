@@ -0,0 +1,93 @@
+#include "distance.h"
+
+#ifdef INDEX_X86_KERNELS
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static bool supportsAvx(int leaf7Bit, unsigned long long xcr0Mask) {
+	int info[4];
+
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+
+	if (!osxsave || !fma || (_xgetbv(0) & xcr0Mask) != xcr0Mask) {
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << leaf7Bit)) != 0;
+}
+
+bool supportsAvx2() {
+	return supportsAvx(5, 0x6);
+}
+
+bool supportsAvx512() {
+	return supportsAvx(16, 0xe6);
+}
+#else
+bool supportsAvx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+bool supportsAvx512() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+#endif
+
+template<class Kernel>
+static KernelInfo kernelInfo() {
+	return {Kernel::name(), Kernel::distance};
+}
+
+struct KernelInfoVisitor {
+	KernelInfo info;
+
+	template<class Kernel>
+	void visit() {
+		info = kernelInfo<Kernel>();
+	}
+};
+
+KernelInfo l2Kernel(int size) {
+	KernelInfoVisitor visitor;
+	visitL2Kernel(size, visitor);
+
+	return visitor.info;
+}
+
+template<int Dim>
+static std::vector<KernelInfo> supportedL2Kernels() {
+	std::vector<KernelInfo> kernels = {kernelInfo<L2Scalar<Dim>>()};
+
+#ifdef INDEX_X86_KERNELS
+	kernels.push_back(kernelInfo<L2Sse2<Dim>>());
+
+	if (supportsAvx2()) {
+		kernels.push_back(kernelInfo<L2Avx2<Dim>>());
+	}
+
+	if (supportsAvx512()) {
+		kernels.push_back(kernelInfo<L2Avx512<Dim>>());
+	}
+#endif
+
+	return kernels;
+}
+
+std::vector<KernelInfo> l2Kernels(int size) {
+	switch (size) {
+		case 128:
+			return supportedL2Kernels<128>();
+		case 512:
+			return supportedL2Kernels<512>();
+		default:
+			return supportedL2Kernels<0>();
+	}
+}
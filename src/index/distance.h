@@ -0,0 +1,247 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <cmath>
+#include <vector>
+
+#include "storage.h"
+
+#if defined(__clang__)
+#define INDEX_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define INDEX_UNROLL _Pragma("GCC unroll 8")
+#else
+#define INDEX_UNROLL
+#endif
+
+#if !defined(INDEX_DOUBLE_PRECISION) && (defined(__x86_64__) || defined(_M_X64))
+#define INDEX_X86_KERNELS
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define INDEX_TARGET(isa)
+#else
+#define INDEX_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Kernels return squared euclidean distance, which orders nodes the same way as the distance itself.
+using DistanceKernel = Scalar (*)(const Scalar *a, const Scalar *b, int size);
+
+struct KernelInfo {
+	const char *name;
+	DistanceKernel kernel;
+};
+
+// Kernels are types, so search loops instantiated with a kernel call it directly and may inline it.
+// Dim > 0 fixes the descriptor size at compile time, Dim = 0 takes it from the size argument.
+template<int Dim>
+struct L2Scalar {
+	static const char* name() {
+		return "scalar";
+	}
+
+	static Scalar distance(const Scalar *a, const Scalar *b, int size) {
+		const int count = Dim > 0 ? Dim : size;
+		Scalar ac[4] = {0, 0, 0, 0};
+		int i = 0;
+
+		INDEX_UNROLL
+		for (; i + 4 <= count; i += 4) {
+			for (int j = 0; j < 4; ++j) {
+				Scalar diff = a[i + j] - b[i + j];
+				ac[j] += diff * diff;
+			}
+		}
+
+		for (; i < count; ++i) {
+			Scalar diff = a[i] - b[i];
+			ac[0] += diff * diff;
+		}
+
+		return (ac[0] + ac[1]) + (ac[2] + ac[3]);
+	}
+};
+
+#ifdef INDEX_X86_KERNELS
+
+bool supportsAvx2();
+bool supportsAvx512();
+
+template<int Dim>
+struct L2Sse2 {
+	static const char* name() {
+		return "sse2";
+	}
+
+	static Scalar distance(const Scalar *a, const Scalar *b, int size) {
+		const int count = Dim > 0 ? Dim : size;
+		__m128 ac0 = _mm_setzero_ps();
+		__m128 ac1 = _mm_setzero_ps();
+		int i = 0;
+
+		INDEX_UNROLL
+		for (; i + 8 <= count; i += 8) {
+			__m128 diff0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+			__m128 diff1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+			ac0 = _mm_add_ps(ac0, _mm_mul_ps(diff0, diff0));
+			ac1 = _mm_add_ps(ac1, _mm_mul_ps(diff1, diff1));
+		}
+
+		for (; i + 4 <= count; i += 4) {
+			__m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+			ac0 = _mm_add_ps(ac0, _mm_mul_ps(diff, diff));
+		}
+
+		ac0 = _mm_add_ps(ac0, ac1);
+		ac0 = _mm_add_ps(ac0, _mm_movehl_ps(ac0, ac0));
+		ac0 = _mm_add_ss(ac0, _mm_shuffle_ps(ac0, ac0, 1));
+
+		Scalar result = _mm_cvtss_f32(ac0);
+
+		for (; i < count; ++i) {
+			Scalar diff = a[i] - b[i];
+			result += diff * diff;
+		}
+
+		return result;
+	}
+};
+
+template<int Dim>
+struct L2Avx2 {
+	static const char* name() {
+		return "avx2";
+	}
+
+	INDEX_TARGET("avx2,fma")
+	static Scalar distance(const Scalar *a, const Scalar *b, int size) {
+		const int count = Dim > 0 ? Dim : size;
+		__m256 ac0 = _mm256_setzero_ps();
+		__m256 ac1 = _mm256_setzero_ps();
+		int i = 0;
+
+		INDEX_UNROLL
+		for (; i + 16 <= count; i += 16) {
+			__m256 diff0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+			__m256 diff1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+			ac0 = _mm256_fmadd_ps(diff0, diff0, ac0);
+			ac1 = _mm256_fmadd_ps(diff1, diff1, ac1);
+		}
+
+		for (; i + 8 <= count; i += 8) {
+			__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+			ac0 = _mm256_fmadd_ps(diff, diff, ac0);
+		}
+
+		ac0 = _mm256_add_ps(ac0, ac1);
+
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(ac0), _mm256_extractf128_ps(ac0, 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+		Scalar result = _mm_cvtss_f32(sum);
+
+		for (; i < count; ++i) {
+			Scalar diff = a[i] - b[i];
+			result += diff * diff;
+		}
+
+		return result;
+	}
+};
+
+template<int Dim>
+struct L2Avx512 {
+	static const char* name() {
+		return "avx512";
+	}
+
+	INDEX_TARGET("avx512f")
+	static Scalar distance(const Scalar *a, const Scalar *b, int size) {
+		const int count = Dim > 0 ? Dim : size;
+		__m512 ac0 = _mm512_setzero_ps();
+		__m512 ac1 = _mm512_setzero_ps();
+		int i = 0;
+
+		INDEX_UNROLL
+		for (; i + 32 <= count; i += 32) {
+			__m512 diff0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+			__m512 diff1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+			ac0 = _mm512_fmadd_ps(diff0, diff0, ac0);
+			ac1 = _mm512_fmadd_ps(diff1, diff1, ac1);
+		}
+
+		for (; i + 16 <= count; i += 16) {
+			__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+			ac0 = _mm512_fmadd_ps(diff, diff, ac0);
+		}
+
+		if (i < count) {
+			__mmask16 mask = static_cast<__mmask16>((1u << (count - i)) - 1);
+			__m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+			ac1 = _mm512_fmadd_ps(diff, diff, ac1);
+		}
+
+		return _mm512_reduce_add_ps(_mm512_add_ps(ac0, ac1));
+	}
+};
+
+#endif
+
+template<int Dim, class Visitor>
+void visitL2KernelOfSize(Visitor &visitor) {
+#ifdef INDEX_X86_KERNELS
+	static const bool avx512 = supportsAvx512();
+	static const bool avx2 = supportsAvx2();
+
+	if (avx512) {
+		visitor.template visit<L2Avx512<Dim>>();
+	} else if (avx2) {
+		visitor.template visit<L2Avx2<Dim>>();
+	} else {
+		visitor.template visit<L2Sse2<Dim>>();
+	}
+#else
+	visitor.template visit<L2Scalar<Dim>>();
+#endif
+}
+
+// Calls visitor.visit<Kernel>() with the best kernel supported by the CPU, specialized for the descriptor size
+// when it is a common one. Callers instantiate their loops with the kernel once instead of calling it through a pointer.
+template<class Visitor>
+void visitL2Kernel(int size, Visitor &visitor) {
+	switch (size) {
+		case 128:
+			visitL2KernelOfSize<128>(visitor);
+			break;
+		case 512:
+			visitL2KernelOfSize<512>(visitor);
+			break;
+		default:
+			visitL2KernelOfSize<0>(visitor);
+	}
+}
+
+// Kernel, that visitL2Kernel picks.
+KernelInfo l2Kernel(int size);
+
+// All kernels supported by the CPU for the descriptor size, the scalar reference first.
+std::vector<KernelInfo> l2Kernels(int size);
+
+struct Euclidean {
+	static KernelInfo kernel(int size) {
+		return l2Kernel(size);
+	}
+
+	template<class Visitor>
+	static void visitKernel(int size, Visitor &visitor) {
+		visitL2Kernel(size, visitor);
+	}
+
+	static double finalize(double distance) {
+		return std::sqrt(distance);
+	}
+};
+
+#endif
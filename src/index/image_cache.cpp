@@ -0,0 +1,63 @@
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <iterator>
+#include <utility>
+
+#include "image_cache.h"
+
+ImageCache::ImageCache(std::string dataset, std::size_t capacity) : dataset(std::move(dataset)), capacity(capacity) {}
+
+void ImageCache::evict(std::list<Entry>::iterator entry) {
+	size -= entry->image->getSize();
+	positions.erase(entry->name);
+	entries.erase(entry);
+}
+
+std::shared_ptr<const MappedFile> ImageCache::get(const std::string &name) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto position = positions.find(name);
+
+	if (position != positions.end()) {
+		entries.splice(entries.begin(), entries, position->second);
+		return position->second->image;
+	}
+
+	lock.unlock();
+
+	// Mapping touches the disk, so it isn't done under the lock.
+	std::shared_ptr<const MappedFile> image = std::make_shared<const MappedFile>(dataset + '/' + name);
+
+	lock.lock();
+
+	if (image->getSize() > capacity) {
+		return image;
+	}
+
+	position = positions.find(name);
+
+	if (position != positions.end()) {
+		evict(position->second);
+	}
+
+	entries.push_front({name, image});
+	positions[name] = entries.begin();
+	size += image->getSize();
+
+	while (size > capacity) {
+		evict(std::prev(entries.end()));
+	}
+
+	return image;
+}
+
+void ImageCache::erase(const std::string &name) {
+	std::unique_lock<std::mutex> lock(mutex);
+	auto position = positions.find(name);
+
+	if (position != positions.end()) {
+		evict(position->second);
+	}
+}
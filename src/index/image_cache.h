@@ -0,0 +1,46 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+#include "storage.h"
+
+// Memory-mapped images of the dataset. Recently served images stay mapped while their total size fits the budget,
+// so hot images are sent straight from memory. Responses keep their image mapped after it's evicted.
+class ImageCache {
+	struct Entry {
+		std::string name;
+		std::shared_ptr<const MappedFile> image;
+	};
+
+	std::string dataset;
+	std::size_t capacity;
+	std::size_t size = 0;
+
+	// Most recently used first.
+	std::list<Entry> entries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> positions;
+	std::mutex mutex;
+
+	void evict(std::list<Entry>::iterator entry);
+
+public:
+	// capacity = 0 maps images for each response without caching.
+	ImageCache(std::string dataset, std::size_t capacity);
+
+	ImageCache(const ImageCache&) = delete;
+	ImageCache& operator=(const ImageCache&) = delete;
+
+	// Throws if the image can't be mapped.
+	std::shared_ptr<const MappedFile> get(const std::string &name);
+
+	// Drops the cached image, e.g. after the file was replaced.
+	void erase(const std::string &name);
+};
+
+#endif
@@ -2,92 +2,135 @@
 #include <vector>
 #include <random>
 #include <cmath>
-#include <unordered_set>
 #include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <functional>
-#include <cstring>
-#include <memory>
 #include <fstream>
-#include <sstream>
+#include <cstdint>
+#include <stdexcept>
+#include <limits>
 
 #include "index.h"
+#include "parser.h"
+#include "thread_pool.h"
 
-std::mt19937 Index::gen(std::random_device{}());
-std::uniform_real_distribution<double> Index::dist(0.0, 1.0);
-std::mutex Index::randomMutex;
+// First word of a link block holds neighbours count in the low bits and a write version in the high bits.
+// The version is odd while links are rewritten, so searches copy links without locks and retry if it has changed.
+static const int linksCountBits = 16;
+static const int linksCountMask = (1 << linksCountBits) - 1;
 
-double Index::generateRand() {
-	std::unique_lock<std::mutex> lock(Index::randomMutex);
-	return dist(gen);
-}
+static_assert(sizeof(std::atomic<int>) == sizeof(int) && ATOMIC_INT_LOCK_FREE == 2, "Link blocks need lock-free int atomics");
 
-double Euclidean::distance(const std::vector<double> &a, const std::vector<double> &b) {
-	double ac = 0.0;
+static std::atomic<int>& linkWord(int *block, int i) {
+	return *reinterpret_cast<std::atomic<int>*>(block + i);
+}
 
-	for (int i = 0; i < a.size(); ++i) {
-		ac += std::pow(a[i] - b[i], 2);
-	}
+static bool isLinksUpdating(int header) {
+	return (static_cast<unsigned>(header) >> linksCountBits) & 1;
+}
 
-	return std::sqrt(ac);
+static int linksHeader(int header, unsigned versionStep, int count) {
+	unsigned version = (static_cast<unsigned>(header) >> linksCountBits) + versionStep;
+	return static_cast<int>((version << linksCountBits) | count);
 }
 
-Index::Node::Node(int id, std::string name, std::vector<double> descriptor, int layersCount, int neighboursCount, int neighboursCount0) :
-id(id), name(std::move(name)), descriptor(std::move(descriptor)), maxLayer(layersCount - 1), layers(layersCount), layersMutexes(layersCount) {
-	if (layersCount > 0) {
-		layers[0].reserve(neighboursCount0);
+// Rewrites links of a block, the caller holds the link mutex of its node.
+static void writeLinks(int *block, const std::vector<int> &newLinks) {
+	int header = block[0];
 
-		for (int i = 1; i < layersCount; ++i) {
-			layers[i].reserve(neighboursCount);
-		}
+	linkWord(block, 0).store(linksHeader(header, 1, header & linksCountMask), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (int i = 0; i < newLinks.size(); ++i) {
+		linkWord(block, i + 1).store(newLinks[i], std::memory_order_relaxed);
 	}
-}
 
-void Index::Node::addNeighbour(const NodePtr &neighbour, int layer) {
-	std::unique_lock<std::mutex> lock(layersMutexes[layer]);
-	layers[layer].push_back(neighbour);
+	linkWord(block, 0).store(linksHeader(header, 2, newLinks.size()), std::memory_order_release);
 }
 
-void Index::NodeQueue::push(NodeDistance item) {
-	container.push_back(item);
-	push_heap(container.begin(), container.end(), DistanceComparator());
+std::mt19937 Index::gen(std::random_device{}());
+std::uniform_real_distribution<double> Index::dist(0.0, 1.0);
+std::mutex Index::randomMutex;
+
+double Index::generateRand() {
+	std::unique_lock<std::mutex> lock(Index::randomMutex);
+	return dist(gen);
 }
 
-void Index::NodeQueue::emplace(double distance, const NodePtr &node) {
-	container.emplace_back(distance, node);
-	push_heap(container.begin(), container.end(), DistanceComparator());
+Index::SearchContext::SearchContext(int searchCount, int neighboursCount) {
+	candidates.reserve(searchCount);
+	results.reserve(searchCount + 1);
+	sortedNeighbours.reserve(neighboursCount);
+	neighbours.reserve(neighboursCount);
+	discarded.reserve(neighboursCount);
+	selected.reserve(neighboursCount);
+	linksCopy.reserve(neighboursCount);
+	unvisited.reserve(neighboursCount);
 }
 
-void Index::NodeQueue::popNearest() {
-	pop_heap(container.begin(), container.end(), DistanceComparator());
-	container.pop_back();
+void Index::SearchContext::prepare(int nodesCount) {
+	if (visited.size() < nodesCount) {
+		visited.resize(nodesCount, visitedTag);
+	}
+
+	evaluationsLeft = std::numeric_limits<int>::max();
 }
 
-void Index::NodeQueue::popFurthest() {
-	container.pop_back();
+void Index::SearchContext::startVisit() {
+	if (++visitedTag == 0) {
+		std::fill(visited.begin(), visited.end(), 0);
+		visitedTag = 1;
+	}
 }
 
 Index::Index(int descriptorSize, Settings settings) {
 	this->descriptorSize = descriptorSize;
-	this->metric = settings.metric;
 	this->M = settings.M;
 	this->M0 = settings.M0;
 	this->efConstruction = settings.efConstruction;
 	this->efSearch = settings.efSearch;
+	this->maxEfSearch = settings.maxEfSearch;
 	this->mL = settings.mL;
 	this->keepPrunedConnections = settings.keepPrunedConnections;
+
+	bindKernel();
+
+	if (std::max(M, M0) >= linksCountMask) {
+		throw std::runtime_error("M and M0 should be less than " + std::to_string(linksCountMask));
+	}
+
+	initStores(0);
 };
 
 void Index::move(Index &&other) {
-	entryPoint = std::move(other.entryPoint);
-	maxId = other.maxId;
+	entryPoint = other.entryPoint.load();
+	maxId = other.maxId.load();
 	descriptorSize = other.descriptorSize;
-	metric = other.metric;
+	descriptors = std::move(other.descriptors);
+	links0 = std::move(other.links0);
+	nodes = std::move(other.nodes);
+	bindKernel();
 	M = other.M;
 	M0 = other.M0;
 	efConstruction = other.efConstruction;
 	efSearch = other.efSearch;
+	maxEfSearch = other.maxEfSearch;
 	mL = other.mL;
+	keepPrunedConnections = other.keepPrunedConnections;
+	logGeneration = other.logGeneration;
+
+	contexts = std::move(other.contexts);
+	dump = std::move(other.dump);
+
+	nameIds = std::move(other.nameIds);
+	removedCount = other.removedCount.load();
+	pendingIds = std::move(other.pendingIds);
+	releasedIds = std::move(other.releasedIds);
+
+	other.entryPoint = -1;
+	other.maxId = -1;
 }
 
 Index::Index(Index &&other) {
@@ -100,99 +143,325 @@ Index& Index::operator=(Index &&other) {
 	return *this;
 }
 
-Index::NodePtr Index::getEntryPoint() {
-	std::unique_lock<std::mutex> lock(entryMutex);
-	return entryPoint;
+int Index::getEntryPoint() {
+	return entryPoint.load(std::memory_order_acquire);
 }
 
-void Index::setEntryPoint(const NodePtr &newEntryPoint) {
+void Index::setEntryPoint(int newEntryPoint) {
 	std::unique_lock<std::mutex> lock(entryMutex);
 
-	if (entryPoint && entryPoint->maxLayer >= newEntryPoint->maxLayer) {
+	if (entryPoint >= 0 && nodes.row(entryPoint)->maxLayer >= nodes.row(newEntryPoint)->maxLayer) {
 		return;
 	}
 
-	entryPoint = newEntryPoint;
+	entryPoint.store(newEntryPoint, std::memory_order_release);
 }
 
 int Index::getSize() {
-	std::unique_lock<std::mutex> lock(idMutex);
-	return maxId + 1;
+	return maxId.load() + 1;
 }
 
 int Index::generateId() {
-	std::unique_lock<std::mutex> lock(idMutex);
 	return ++maxId;
 }
 
-Index::NodePtr Index::createNode(std::string name, std::vector<double> descriptor, int layer) {
-	return std::make_shared<Node>(generateId(), std::move(name), std::move(descriptor), layer + 1, M + 1, M0 + 1);
+// Released ids aren't reused while a snapshot holds the lock, new ids are taken instead.
+int Index::takeReleasedId() {
+	std::unique_lock<std::mutex> lock(releasedMutex, std::try_to_lock);
+
+	if (!lock || releasedIds.empty()) {
+		return -1;
+	}
+
+	int id = releasedIds.back();
+	releasedIds.pop_back();
+
+	return id;
+}
+
+bool Index::isLive(int id) {
+	return nodes.row(id)->state.load(std::memory_order_acquire) == NodeState::Live;
+}
+
+void Index::initStores(int capacity) {
+	descriptors = RowStore<Scalar>(descriptorSize, capacity, cacheLineSize);
+	links0 = RowStore<int>(M0 + 2, capacity);
+	nodes = RowStore<Node>(1, capacity);
 }
 
-double Index::distance(const NodePtr &a, const NodePtr &b) {
-	return metric->distance(a->descriptor, b->descriptor);
+int Index::createNode(std::string name, const Scalar *descriptor, int layer) {
+	int id = takeReleasedId();
+	Node *node;
+
+	// Repair releases an id, after links of traversed nodes stopped leading to it and traversals, that could have
+	// read it before, ended. So no search or insert reads the rows of a reused id, until its state is Live again.
+	if (id >= 0) {
+		std::copy(descriptor, descriptor + descriptorSize, descriptors.row(id));
+
+		int *block = links0.row(id);
+		linkWord(block, 0).store(linksHeader(block[0], 2, 0), std::memory_order_release);
+
+		node = nodes.row(id);
+	} else {
+		id = generateId();
+
+		std::copy(descriptor, descriptor + descriptorSize, descriptors.allocate(id));
+		links0.allocate(id)[0] = 0;
+
+		node = nodes.allocate(id);
+	}
+
+	node->name = std::move(name);
+	node->maxLayer = layer;
+	node->upperLinks.assign(layer * (M + 2), 0);
+	node->state.store(NodeState::Live, std::memory_order_release);
+
+	std::unique_lock<std::mutex> lock(namesMutex);
+	nameIds.emplace(node->name, id);
+
+	return id;
+}
+
+int* Index::links(int id, int layer) {
+	if (layer == 0) {
+		return links0.row(id);
+	}
+
+	return nodes.row(id)->upperLinks.data() + (layer - 1) * (M + 2);
+}
+
+std::mutex& Index::linkMutex(int id) {
+	return linkMutexes[id & (linkMutexesCount - 1)];
 }
 
-void Index::searchAtLayer(
-	const NodePtr &target, const NodePtr &entry, int searchCount, int layer,
-	NodeQueue &candidates, bool *visited, int candidatesCount, NodeQueue &result
-) {
-	double entryDistance = distance(target, entry);
+void Index::readLinks(int id, int layer, NodeList &result) {
+	int *block = links(id, layer);
+	std::atomic<int> &headerWord = linkWord(block, 0);
+
+	while (true) {
+		int header = headerWord.load(std::memory_order_acquire);
+
+		if (isLinksUpdating(header)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		int count = header & linksCountMask;
+		result.resize(count);
+
+		for (int i = 0; i < count; ++i) {
+			result[i] = linkWord(block, i + 1).load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (headerWord.load(std::memory_order_relaxed) == header) {
+			return;
+		}
+	}
+}
+
+struct Index::KernelBinding {
+	Index &index;
+
+	template<class Kernel>
+	void visit() {
+		index.distanceKernel = Kernel::distance;
+		index.layerSearch = &Index::searchAtLayerWith<Kernel>;
+	}
+};
+
+void Index::bindKernel() {
+	KernelBinding binding{*this};
+	Metric::visitKernel(descriptorSize, binding);
+}
+
+double Index::distance(const Scalar *a, int b) {
+	return distanceKernel(a, descriptors.row(b), descriptorSize);
+}
+
+double Index::distance(int a, int b) {
+	return distanceKernel(descriptors.row(a), descriptors.row(b), descriptorSize);
+}
+
+int Index::enterTraversal() {
+	while (true) {
+		int slot = traversalEpoch.load() & 1;
+		++traversalsCounts[slot];
+
+		// The epoch may have changed before the count, then waitForTraversals could have missed it.
+		if ((traversalEpoch.load() & 1) == slot) {
+			return slot;
+		}
+
+		--traversalsCounts[slot];
+	}
+}
+
+void Index::leaveTraversal(int slot) {
+	--traversalsCounts[slot];
+}
+
+void Index::waitForTraversals() {
+	int slot = traversalEpoch++ & 1;
+
+	while (traversalsCounts[slot] > 0) {
+		std::this_thread::yield();
+	}
+}
+
+std::unique_ptr<Index::SearchContext> Index::acquireContext() {
+	std::unique_ptr<SearchContext> context;
+
+	std::unique_lock<std::mutex> lock(contextsMutex);
+
+	if (!contexts.empty()) {
+		context = std::move(contexts.back());
+		contexts.pop_back();
+	}
+
+	lock.unlock();
+
+	if (!context) {
+		int maxM = std::max(M, M0) + 1;
+		context.reset(new SearchContext(std::max(efConstruction, efSearch) + maxM, maxM));
+	}
+
+	context->prepare(getSize());
+
+	return context;
+}
+
+void Index::releaseContext(std::unique_ptr<SearchContext> context) {
+	std::unique_lock<std::mutex> lock(contextsMutex);
+	contexts.push_back(std::move(context));
+}
+
+void Index::connect(int id, int neighbour, int layer, SearchContext &context) {
+	int maxM = (layer == 0) ? M0 : M;
+
+	std::unique_lock<std::mutex> lock(linkMutex(id));
+	int *block = links(id, layer);
+	int header = block[0];
+	int count = (header & linksCountMask) + 1;
+
+	// The new link is past the published count, so readers can't see it before the header changes.
+	linkWord(block, count).store(neighbour, std::memory_order_relaxed);
+
+	if (count <= maxM) {
+		linkWord(block, 0).store(linksHeader(header, 2, count), std::memory_order_release);
+		return;
+	}
+
+	std::vector<NodeDistance> &sortedNeighbours = context.sortedNeighbours;
+
+	for (int i = 1; i <= count; ++i) {
+		sortedNeighbours.emplace_back(distance(id, block[i]), block[i]);
+	}
+
+	std::sort(sortedNeighbours.begin(), sortedNeighbours.end(), [](const NodeDistance &a, const NodeDistance &b) {
+		return a.distance < b.distance;
+	});
+
+	selectNeighbours(maxM, sortedNeighbours, context.discarded, context.selected);
+
+	writeLinks(block, context.selected);
+
+	sortedNeighbours.clear();
+	context.discarded.clear();
+	context.selected.clear();
+}
+
+void Index::searchAtLayer(const Scalar *target, int entry, int searchCount, int layer, SearchContext &context) {
+	(this->*layerSearch)(target, entry, searchCount, layer, context);
+}
+
+template<class Kernel>
+void Index::searchAtLayerWith(const Scalar *target, int entry, int searchCount, int layer, SearchContext &context) {
+	CandidateQueue &candidates = context.candidates;
+	ResultQueue &result = context.results;
+
+	candidates.clear();
+	result.clear();
+	context.startVisit();
+
+	std::size_t descriptorBytes = descriptorSize * sizeof(Scalar);
+	std::size_t descriptorPrefetchSize = descriptorBytes < maxDescriptorPrefetch ? descriptorBytes : maxDescriptorPrefetch;
+
+	double entryDistance = Kernel::distance(target, descriptors.row(entry), descriptorSize);
 	result.emplace(entryDistance, entry);
 	candidates.emplace(entryDistance, entry);
-	visited[entry->id] = true;
+	context.visit(entry);
 
-	while (!candidates.empty()) {
-		NodeDistance candidate = candidates.nearest();
-		candidates.popNearest();
+	while (!candidates.empty() && context.evaluationsLeft > 0) {
+		NodeDistance candidate = candidates.top();
+		candidates.pop();
 
-		if (candidate.distance > result.furthest().distance) {
+		if (candidate.distance > result.top().distance) {
 			break;
 		}
 
-		std::unique_lock<std::mutex> lock(candidate.node->layersMutexes[layer]);
+		readLinks(candidate.id, layer, context.linksCopy);
 
-		for (const NodePtr &neighbour : candidate.node->layers[layer]) {
-			if (neighbour->id >= candidatesCount || visited[neighbour->id]) {
-				continue;
+		// Descriptors of all unvisited neighbours are requested before the first distance, so their loads overlap.
+		for (int neighbour : context.linksCopy) {
+			context.prefetchVisit(neighbour);
+		}
+
+		context.unvisited.clear();
+
+		for (int neighbour : context.linksCopy) {
+			if (context.visit(neighbour)) {
+				context.unvisited.push_back(neighbour);
+				prefetch(descriptors.row(neighbour), descriptorPrefetchSize);
+			}
+		}
+
+		for (int neighbour : context.unvisited) {
+			if (context.evaluationsLeft-- == 0) {
+				break;
 			}
 
-			visited[neighbour->id] = true;
-			double neighbourDistance = distance(target, neighbour);
+			double neighbourDistance = Kernel::distance(target, descriptors.row(neighbour), descriptorSize);
 
-			if (neighbourDistance < result.furthest().distance || result.size() < searchCount) {
+			if (neighbourDistance < result.top().distance || result.size() < searchCount) {
 				candidates.emplace(neighbourDistance, neighbour);
 				result.emplace(neighbourDistance, neighbour);
 
 				if (result.size() > searchCount) {
-					result.popFurthest();
+					result.pop();
 				}
 			}
 		}
+
+		// Links of the next candidate are read right away.
+		if (!candidates.empty()) {
+			prefetch(links(candidates.top().id, layer));
+		}
 	}
 }
 
-void Index::selectNeighbours(
-	const NodePtr &target, int count, int layer,
-	NodeQueue &candidates, NodeList &discarded, NodeList &result
-) {
-	while (candidates.size() > 0 && result.size() < count) {
-		NodeDistance candidate = candidates.nearest();
-		candidates.popNearest();
+void Index::selectNeighbours(int count, const std::vector<NodeDistance> &candidates, NodeList &discarded, NodeList &result) {
+	for (int i = 0; i < candidates.size() && result.size() < count; ++i) {
+		const NodeDistance &candidate = candidates[i];
+
+		if (!isLive(candidate.id)) {
+			continue;
+		}
 
 		bool isCloser = true;
 
-		for (const NodePtr &resultNode : result) {
-			if (distance(resultNode, candidate.node) < candidate.distance) {
+		for (int resultNode : result) {
+			if (distance(resultNode, candidate.id) < candidate.distance) {
 				isCloser = false;
 				break;
 			}
 		}
 
 		if (isCloser) {
-			result.push_back(candidate.node);
+			result.push_back(candidate.id);
 		} else {
-			discarded.push_back(candidate.node);
+			discarded.push_back(candidate.id);
 		}
 	}
 
@@ -203,300 +472,700 @@ void Index::selectNeighbours(
 	}
 }
 
-void Index::insert(std::string name, std::vector<double> descriptor) {
+void Index::insert(std::string name, const std::vector<Scalar> &descriptor) {
+	insert(std::move(name), descriptor.data());
+}
+
+void Index::insert(std::string name, const Scalar *descriptor) {
 	int nodeLayer = static_cast<int>(-std::log(Index::generateRand()) * mL);
-	NodePtr newNode = createNode(std::move(name), std::move(descriptor), nodeLayer);
+	int newNode = createNode(std::move(name), descriptor, nodeLayer);
+	const Scalar *target = descriptors.row(newNode);
 
-	NodePtr entry = getEntryPoint();
+	Traversal traversal(*this);
+	int entry = getEntryPoint();
 
-	if (!entry) {
+	if (entry < 0) {
 		setEntryPoint(newNode);
 		return;
 	}
 
-	int candidatesCount = getSize();
+	PooledContext context(*this);
 
-	NodeQueue candidates;
-	candidates.reserve(candidatesCount);
+	int maxLayer = nodes.row(entry)->maxLayer;
 
-	NodeList discarded;
-	discarded.reserve(candidatesCount);
+	for (int layer = maxLayer; layer > nodeLayer; --layer) {
+		searchAtLayer(target, entry, 1, layer, *context);
+		entry = context->results.top().id;
+	}
 
-	bool *visited = new bool[candidatesCount];
-	memset(visited, false, candidatesCount);
+	for (int layer = std::min(nodeLayer, maxLayer); layer >= 0; --layer) {
+		int maxM = (layer == 0) ? M0 : M;
+		int searchCount = std::max(efConstruction, maxM);
 
-	int maxSearchCount = std::max(efConstruction, std::max(M, M0)) + 1;
+		searchAtLayer(target, entry, searchCount, layer, *context);
 
-	NodeQueue nearestNodes;
-	nearestNodes.reserve(maxSearchCount);
+		const std::vector<NodeDistance> &nearestNodes = context->results.sort();
+		entry = nearestNodes.front().id;
 
-	int maxLayer = entry->maxLayer;
+		selectNeighbours(M, nearestNodes, context->discarded, context->neighbours);
+		context->discarded.clear();
 
-	for (int layer = maxLayer; layer > nodeLayer; --layer) {
-		searchAtLayer(newNode, entry, 1, layer, candidates, visited, candidatesCount, nearestNodes);
-		entry = nearestNodes.nearest().node;
+		for (int neighbour : context->neighbours) {
+			connect(newNode, neighbour, layer, *context);
+			connect(neighbour, newNode, layer, *context);
+		}
 
-		candidates.clear();
-		memset(visited, false, candidatesCount);
-		nearestNodes.clear();
+		context->neighbours.clear();
 	}
 
-	int maxNeighboursCount = std::max(M, M0) + 1;
+	if (nodeLayer > maxLayer) {
+		setEntryPoint(newNode);
+	}
+}
 
-	NodeList neighbours;
-	neighbours.reserve(maxNeighboursCount);
+bool Index::contains(const std::string &name) {
+	std::unique_lock<std::mutex> lock(namesMutex);
+	return nameIds.count(name) > 0;
+}
 
-	NodeQueue sortedNeighbours;
-	sortedNeighbours.reserve(maxNeighboursCount);
+int Index::remove(const std::string &name) {
+	std::unique_lock<std::mutex> lock(namesMutex);
+	auto range = nameIds.equal_range(name);
+	int count = 0;
 
-	for (int layer = std::min(nodeLayer, maxLayer); layer >= 0; --layer) {
-		int maxM = (layer == 0) ? M0 : M;
-		int searchCount = std::max(efConstruction, maxM);
+	for (auto item = range.first; item != range.second; ++item) {
+		NodeState live = NodeState::Live;
 
-		searchAtLayer(newNode, entry, searchCount, layer, candidates, visited, candidatesCount, nearestNodes);
-		entry = nearestNodes.nearest().node;
+		if (nodes.row(item->second)->state.compare_exchange_strong(live, NodeState::Removed)) {
+			++count;
+		}
+	}
 
-		selectNeighbours(newNode, M, layer, nearestNodes, discarded, neighbours);
-		discarded.clear();
+	nameIds.erase(range.first, range.second);
+	removedCount += count;
 
-		for (const NodePtr &neighbour : neighbours) {
-			newNode->addNeighbour(neighbour, layer);
-			neighbour->addNeighbour(newNode, layer);
-		}
+	return count;
+}
 
-		for (const NodePtr &neighbour : neighbours) {
-			std::unique_lock<std::mutex> lock(neighbour->layersMutexes[layer]);
-			NodeList &neighbourhood = neighbour->layers[layer];
+void Index::repairLinks(int id, int layer, SearchContext &context) {
+	int maxM = (layer == 0) ? M0 : M;
 
-			if (neighbourhood.size() > maxM) {
-				for (const NodePtr &node : neighbourhood) {
-					sortedNeighbours.emplace(distance(neighbour, node), node);
-				}
+	std::unique_lock<std::mutex> lock(linkMutex(id));
+	int *block = links(id, layer);
+	int count = block[0] & linksCountMask;
 
-				neighbourhood.clear();
-				selectNeighbours(neighbour, maxM, layer, sortedNeighbours, discarded, neighbourhood);
+	if (std::all_of(block + 1, block + count + 1, [this](int neighbour) { return isLive(neighbour); })) {
+		return;
+	}
 
-				sortedNeighbours.clear();
-				discarded.clear();
+	// Removed neighbours are replaced with their own neighbours, which are re-selected with the rest.
+	NodeList &candidates = context.neighbours;
+
+	for (int i = 1; i <= count; ++i) {
+		if (isLive(block[i])) {
+			candidates.push_back(block[i]);
+			continue;
+		}
+
+		readLinks(block[i], layer, context.linksCopy);
+
+		for (int second : context.linksCopy) {
+			if (second != id && isLive(second)) {
+				candidates.push_back(second);
 			}
 		}
+	}
 
-		candidates.clear();
-		memset(visited, false, candidatesCount);
-		nearestNodes.clear();
-		neighbours.clear();
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	std::vector<NodeDistance> &sortedNeighbours = context.sortedNeighbours;
+
+	for (int candidate : candidates) {
+		sortedNeighbours.emplace_back(distance(id, candidate), candidate);
 	}
 
-	if (nodeLayer > maxLayer) {
-		setEntryPoint(newNode);
+	std::sort(sortedNeighbours.begin(), sortedNeighbours.end(), [](const NodeDistance &a, const NodeDistance &b) {
+		return a.distance < b.distance;
+	});
+
+	selectNeighbours(maxM, sortedNeighbours, context.discarded, context.selected);
+	writeLinks(block, context.selected);
+
+	candidates.clear();
+	sortedNeighbours.clear();
+	context.discarded.clear();
+	context.selected.clear();
+}
+
+// Live node of the highest layer among the first nodesCount ones.
+int Index::findEntryPoint(int nodesCount) {
+	int entry = -1;
+
+	for (int id = 0; id < nodesCount; ++id) {
+		Node *node = nodes.find(id);
+
+		if (node && node->state == NodeState::Live && (entry < 0 || node->maxLayer > nodes.row(entry)->maxLayer)) {
+			entry = id;
+		}
 	}
+
+	return entry;
 }
 
-std::vector<SearchResult> Index::search(std::vector<double> descriptor, int k) {
-	if (!entryPoint) {
-		return std::vector<SearchResult>();
+int Index::repair() {
+	std::unique_lock<std::mutex> lock(repairMutex);
+
+	if (removedCount == 0 && pendingIds.empty()) {
+		return 0;
 	}
 
-	NodePtr node = std::make_shared<Node>(std::move(descriptor));
+	// Ids are taken before their rows are allocated, so rows below the size may be missing yet.
+	int nodesCount = getSize();
+	PooledContext context(*this);
 
-	int searchCount = std::max(efSearch, k);
-	int candidatesCount = getSize();
+	// Inserts, that started while pending ids were still live, could link them and are waited for.
+	waitForTraversals();
 
-	NodeQueue nearestNodes;
-	nearestNodes.reserve(searchCount);
+	std::unique_lock<std::mutex> entryLock(entryMutex);
 
-	NodeQueue candidates;
-	candidates.reserve(candidatesCount);
+	if (entryPoint >= 0 && !isLive(entryPoint)) {
+		entryPoint.store(findEntryPoint(nodesCount), std::memory_order_release);
+	}
 
-	bool *visited = new bool[candidatesCount];
-	memset(visited, false, candidatesCount);
+	entryLock.unlock();
 
-	NodePtr entry = getEntryPoint();
-	int maxLayer = entry->maxLayer;
+	// Removed nodes are still traversed, so their links are repaired as well.
+	for (int id = 0; id < nodesCount; ++id) {
+		Node *node = nodes.find(id);
 
-	for (int layer = maxLayer; layer > 0; --layer) {
-		searchAtLayer(node, entry, 1, layer, candidates, visited, candidatesCount, nearestNodes);
-		entry = nearestNodes.nearest().node;
+		if (!node || (node->state != NodeState::Live && node->state != NodeState::Removed)) {
+			continue;
+		}
 
-		candidates.clear();
-		memset(visited, false, candidatesCount);
-		nearestNodes.clear();
+		for (int layer = 0; layer <= node->maxLayer; ++layer) {
+			repairLinks(id, layer, *context);
+		}
 	}
 
-	searchAtLayer(node, entry, searchCount, 0, candidates, visited, candidatesCount, nearestNodes);
+	// Ids pending since the previous repair are no longer linked from traversed nodes or the entry point,
+	// only traversals, that started before, may still read them.
+	waitForTraversals();
 
-	int resultSize = std::min(k, nearestNodes.size());
-	std::vector<SearchResult> result;
-	result.reserve(resultSize);
+	int changedCount = pendingIds.size();
+	std::unique_lock<std::mutex> releasedLock(releasedMutex);
+	releasedIds.insert(releasedIds.end(), pendingIds.begin(), pendingIds.end());
+	releasedLock.unlock();
+
+	pendingIds.clear();
 
-	for (int i = 0; i < resultSize; ++i) {
-		NodeDistance closeNode = nearestNodes[i];
-		result.emplace_back(closeNode.node->name, closeNode.node->descriptor, closeNode.distance);
+	for (int id = 0; id < nodesCount; ++id) {
+		Node *node = nodes.find(id);
+		NodeState removed = NodeState::Removed;
+
+		if (node && node->state.compare_exchange_strong(removed, NodeState::Released)) {
+			pendingIds.push_back(id);
+			--removedCount;
+		}
 	}
 
-	return result;
+	return changedCount + pendingIds.size();
 }
 
-Index::NodeList Index::collectNodes() {
-	if (!entryPoint) {
-		return NodeList();
+void Index::checkSearchParams(const SearchParams &params) {
+	if (params.k < 1 || params.k > maxEfSearch) {
+		throw std::runtime_error("k should be between 1 and " + std::to_string(maxEfSearch));
 	}
 
-	NodeList nodes;
-	nodes.reserve(maxId + 1);
+	if (params.ef < 0 || params.ef > maxEfSearch) {
+		throw std::runtime_error("ef should be between 0 and " + std::to_string(maxEfSearch) + ", 0 searches with efSearch");
+	}
 
-	NodeList candidates;
-	candidates.reserve(maxId + 1);
-	candidates.push_back(entryPoint);
+	if (params.maxEvaluations < 0) {
+		throw std::runtime_error("maxEvaluations should be positive or zero, 0 doesn't limit evaluations");
+	}
+}
 
-	std::vector<bool> visited(maxId + 1, false);
-	visited[entryPoint->id] = true;
+std::vector<SearchResult> Index::search(const std::vector<Scalar> &descriptor, const SearchParams &params) {
+	checkSearchParams(params);
 
-	while (!candidates.empty()) {
-		const NodePtr &candidate = candidates.back();
-		candidates.pop_back();
+	Traversal traversal(*this);
+	int entry = getEntryPoint();
 
-		nodes.push_back(candidate);
+	if (entry < 0) {
+		return std::vector<SearchResult>();
+	}
 
-		NodeList &neighbours = candidate->layers[0];
+	const Scalar *target = descriptor.data();
+	int k = params.k;
+	int searchCount = std::max(params.ef > 0 ? params.ef : efSearch, k);
 
-		for (const NodePtr &neighbour : neighbours) {
-			if (!visited[neighbour->id]) {
-				candidates.push_back(neighbour);
-				visited[neighbour->id] = true;
-			}
+	PooledContext context(*this);
+
+	if (params.maxEvaluations > 0) {
+		context->evaluationsLeft = params.maxEvaluations;
+	}
+
+	int maxLayer = nodes.row(entry)->maxLayer;
+
+	for (int layer = maxLayer; layer > 0; --layer) {
+		searchAtLayer(target, entry, 1, layer, *context);
+		entry = context->results.top().id;
+	}
+
+	searchAtLayer(target, entry, searchCount, 0, *context);
+
+	const std::vector<NodeDistance> &nearestNodes = context->results.sort();
+
+	std::vector<SearchResult> result;
+	result.reserve(std::min(k, static_cast<int>(nearestNodes.size())));
+
+	for (int i = 0; i < nearestNodes.size() && result.size() < k; ++i) {
+		const NodeDistance &closeNode = nearestNodes[i];
+
+		if (!isLive(closeNode.id)) {
+			continue;
+		}
+
+		const std::string &name = nodes.row(closeNode.id)->name;
+		double closeDistance = Metric::finalize(closeNode.distance);
+
+		if (params.withDescriptors) {
+			const Scalar *closeDescriptor = descriptors.row(closeNode.id);
+			result.emplace_back(name, std::vector<Scalar>(closeDescriptor, closeDescriptor + descriptorSize), closeDistance);
+		} else {
+			result.emplace_back(name, closeDistance);
 		}
 	}
 
-	return nodes;
+	return result;
 }
 
-void Index::save(std::string filename) {
-	std::ofstream file(filename);
+const char Index::dumpMagic[8] = {'I', 'M', 'L', 'K', 'D', 'U', 'M', 'P'};
+
+static std::uint64_t alignOffset(std::uint64_t offset) {
+	return (offset + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+}
+
+static void writePadding(std::ofstream &file, std::uint64_t offset) {
+	static const char zeros[cacheLineSize] = {};
+	std::uint64_t position = file.tellp();
+
+	file.write(zeros, offset - position);
+}
+
+// Breadth-first order of the graph from the entry point. Graph neighbours get close ids in the dump,
+// so each hop of a search touches rows near the previous ones. Nodes unreachable from the entry point go last.
+Index::NodeList Index::orderNodes(const Snapshot &snapshot, int entry) {
+	int nodesCount = snapshot.nodesCount;
+	NodeList order;
+	std::vector<char> isOrdered(nodesCount, false);
+	NodeList links;
 
-	NodeList nodes = collectNodes();
+	order.reserve(nodesCount);
 
-	file << nodes.size() << "," << maxId << "," << entryPoint->id << "," << descriptorSize << ","
-		<< M << "," << M0 << "," << efConstruction << "," << efSearch << "," << mL << "," << keepPrunedConnections << "\n";
+	if (entry >= 0) {
+		order.push_back(entry);
+		isOrdered[entry] = true;
+	}
 
-	for (const NodePtr &node : nodes) {
-		file << node->id << "," << node->name;
+	// Upper layers are traversed first, their nodes are visited by every search.
+	for (int layer = entry >= 0 ? nodes.row(entry)->maxLayer : -1; layer >= 0; --layer) {
+		for (int next = 0; next < order.size(); ++next) {
+			if (nodes.row(order[next])->maxLayer < layer) {
+				continue;
+			}
 
-		for (double item : node->descriptor) {
-			file << "," << item;
+			readLinks(snapshot, order[next], layer, links);
+
+			for (int neighbour : links) {
+				if (neighbour < nodesCount && !isOrdered[neighbour]) {
+					order.push_back(neighbour);
+					isOrdered[neighbour] = true;
+				}
+			}
 		}
+	}
 
-		file << "," << node->maxLayer + 1 << "\n";
+	for (int id = 0; id < nodesCount; ++id) {
+		if (!isOrdered[id]) {
+			order.push_back(id);
+		}
 	}
 
-	for (const NodePtr &node : nodes) {
-		int layersCount = node->maxLayer + 1;
+	return order;
+}
 
-		for (int layer = 0; layer < layersCount; ++layer) {
-			NodeList &neighbours = node->layers[layer];
+Index::Snapshot::Snapshot(Index &index, std::uint32_t generation) :
+	reuseLock(index.releasedMutex), nodesCount(index.getSize()), entryPoint(index.getEntryPoint()), generation(generation),
+	linksOffsets(nodesCount) {
+	NodeList blockLinks;
 
-			file << node->id << "," << layer << "," << neighbours.size();
+	for (int id = 0; id < nodesCount; ++id) {
+		int maxLayer = index.nodes.row(id)->maxLayer;
+		linksOffsets[id] = links.size();
 
-			for (const NodePtr &neighbour : neighbours) {
-				file << "," << neighbour->id;
-			}
+		for (int layer = 0; layer <= maxLayer; ++layer) {
+			index.readLinks(id, layer, blockLinks);
 
-			file << "\n";
+			links.push_back(blockLinks.size());
+			links.insert(links.end(), blockLinks.begin(), blockLinks.end());
+			links.resize(links.size() + ((layer == 0) ? index.M0 : index.M) + 1 - blockLinks.size());
 		}
 	}
 }
 
-void Index::load(std::string filename, Metric *metric) {
-	std::ifstream file(filename);
+void Index::readLinks(const Snapshot &snapshot, int id, int layer, NodeList &result) {
+	const int *block = snapshot.links.data() + snapshot.linksOffsets[id];
+
+	if (layer > 0) {
+		block += (M0 + 2) + (layer - 1) * (M + 2);
+	}
+
+	result.assign(block + 1, block + block[0] + 1);
+}
+
+Index::Snapshot Index::snapshot(std::uint32_t generation) {
+	return Snapshot(*this, generation);
+}
+
+void Index::save(std::string filename) {
+	save(filename, snapshot(logGeneration));
+}
+
+void Index::save(std::string filename, const Snapshot &snapshot) {
+	int nodesCount = snapshot.nodesCount;
+	int entry = snapshot.entryPoint;
+
+	if (entry >= nodesCount || (entry >= 0 && !isLive(entry))) {
+		entry = findEntryPoint(nodesCount);
+	}
+
+	// Nodes are saved in order[0], order[1]... and links are relabeled to their positions.
+	NodeList order = orderNodes(snapshot, entry);
+	NodeList savedIds(nodesCount);
+
+	for (int savedId = 0; savedId < nodesCount; ++savedId) {
+		savedIds[order[savedId]] = savedId;
+	}
+
+	std::uint64_t upperLinksCount = 0;
+	std::uint64_t namesSize = 0;
 
-	std::string line;
-	std::string item;
-	std::istringstream lineStream;
+	for (int id = 0; id < nodesCount; ++id) {
+		Node *node = nodes.row(id);
 
-	getline(file, line);
-	lineStream.str(line);
+		upperLinksCount += node->upperLinks.size();
+		namesSize += node->name.size();
+	}
+
+	DumpHeader header = {};
+	std::copy(dumpMagic, dumpMagic + sizeof(dumpMagic), header.magic);
+	header.version = dumpVersion;
+	header.scalarSize = sizeof(Scalar);
+	header.nodesCount = nodesCount;
+	header.entryPoint = entry >= 0 ? savedIds[entry] : entry;
+	header.descriptorSize = descriptorSize;
+	header.M = M;
+	header.M0 = M0;
+	header.efConstruction = efConstruction;
+	header.efSearch = efSearch;
+	header.keepPrunedConnections = keepPrunedConnections;
+	header.mL = mL;
+	header.descriptorStride = descriptors.getStride();
+
+	header.descriptorsOffset = alignOffset(sizeof(DumpHeader));
+	header.links0Offset = alignOffset(header.descriptorsOffset + nodesCount * header.descriptorStride * sizeof(Scalar));
+	header.levelsOffset = alignOffset(header.links0Offset + nodesCount * (M0 + 2) * sizeof(std::int32_t));
+	header.upperLinksOffset = alignOffset(header.levelsOffset + nodesCount * sizeof(std::int32_t));
+	header.statesOffset = alignOffset(header.upperLinksOffset + upperLinksCount * sizeof(std::int32_t));
+	header.namesOffset = alignOffset(header.statesOffset + nodesCount * sizeof(std::uint8_t));
+	header.fileSize = header.namesOffset + (nodesCount + 1) * sizeof(std::uint64_t) + namesSize;
+	header.logGeneration = snapshot.generation;
+
+	std::ofstream file(filename, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<Scalar> descriptor(header.descriptorStride, 0);
+	writePadding(file, header.descriptorsOffset);
+
+	for (int id : order) {
+		std::copy(descriptors.row(id), descriptors.row(id) + descriptorSize, descriptor.begin());
+		file.write(reinterpret_cast<const char*>(descriptor.data()), descriptor.size() * sizeof(Scalar));
+	}
 
-	std::getline(lineStream, item, ',');
-	int nodesCount = std::stoi(item);
+	// Links to nodes newer than the saved ones are dropped.
+	NodeList links;
+	std::vector<std::int32_t> block(std::max(M, M0) + 2, 0);
 
-	std::getline(lineStream, item, ',');
-	maxId = std::stoi(item);
+	auto copyLinks = [&](int id, int layer) {
+		readLinks(snapshot, id, layer, links);
+		std::fill(block.begin(), block.end(), 0);
 
-	std::getline(lineStream, item, ',');
-	int entryPointId = std::stoi(item);
+		for (int neighbour : links) {
+			if (neighbour < nodesCount) {
+				block[++block[0]] = savedIds[neighbour];
+			}
+		}
+	};
 
-	std::getline(lineStream, item, ',');
-	descriptorSize = std::stoi(item);
+	writePadding(file, header.links0Offset);
 
-	std::getline(lineStream, item, ',');
-	M = std::stoi(item);
+	for (int id : order) {
+		copyLinks(id, 0);
+		file.write(reinterpret_cast<const char*>(block.data()), (M0 + 2) * sizeof(std::int32_t));
+	}
 
-	std::getline(lineStream, item, ',');
-	M0 = std::stoi(item);
+	writePadding(file, header.levelsOffset);
 
-	std::getline(lineStream, item, ',');
-	efConstruction = std::stoi(item);
+	for (int id : order) {
+		std::int32_t maxLayer = nodes.row(id)->maxLayer;
+		file.write(reinterpret_cast<const char*>(&maxLayer), sizeof(maxLayer));
+	}
 
-	std::getline(lineStream, item, ',');
-	efSearch = std::stoi(item);
+	writePadding(file, header.upperLinksOffset);
 
-	this->metric = metric;
+	for (int id : order) {
+		for (int layer = 1; layer <= nodes.row(id)->maxLayer; ++layer) {
+			copyLinks(id, layer);
+			file.write(reinterpret_cast<const char*>(block.data()), (M + 2) * sizeof(std::int32_t));
+		}
+	}
 
-	NodeList nodes(maxId + 1);
+	writePadding(file, header.statesOffset);
 
-	for (int i = 0; i < nodesCount; ++i) {
-		getline(file, line);
-		lineStream.str(line);
-		lineStream.clear();
+	for (int id : order) {
+		NodeState state = nodes.row(id)->state;
+		std::uint8_t savedState = static_cast<std::uint8_t>(state == NodeState::Creating ? NodeState::Released : state);
+		file.write(reinterpret_cast<const char*>(&savedState), sizeof(savedState));
+	}
 
-		std::getline(lineStream, item, ',');
-		int id = std::stoi(item);
+	writePadding(file, header.namesOffset);
 
-		std::string name;
-		std::getline(lineStream, name, ',');
+	std::uint64_t nameOffset = 0;
 
-		std::vector<double> descriptor;
-		descriptor.reserve(descriptorSize);
+	for (int savedId = 0; savedId <= nodesCount; ++savedId) {
+		file.write(reinterpret_cast<const char*>(&nameOffset), sizeof(nameOffset));
 
-		for (int j = 0; j < descriptorSize; ++j) {
-			std::getline(lineStream, item, ',');
-			descriptor.push_back(std::stod(item));
+		if (savedId < nodesCount) {
+			nameOffset += nodes.row(order[savedId])->name.size();
 		}
+	}
 
-		std::getline(lineStream, item, ',');
-		int layersCount = std::stoi(item);
+	for (int id : order) {
+		const std::string &name = nodes.row(id)->name;
+		file.write(name.data(), name.size());
+	}
 
-		nodes[id] = std::move(std::make_shared<Node>(id, std::move(name), std::move(descriptor), layersCount, M + 1, M0 + 1));
+	if (file.fail()) {
+		throw std::runtime_error("Can't write dump " + filename);
 	}
+}
 
-	entryPoint = nodes[entryPointId];
+void Index::load(std::string filename) {
+	std::ifstream file(filename, std::ios::binary);
+	char magic[sizeof(dumpMagic)] = {};
 
-	while (getline(file, line)) {
-		lineStream.str(line);
-		lineStream.clear();
+	file.read(magic, sizeof(magic));
+	file.close();
 
-		std::getline(lineStream, item, ',');
-		int nodeId = std::stoi(item);
+	if (std::equal(magic, magic + sizeof(magic), dumpMagic)) {
+		loadBinary(filename);
+	} else {
+		loadText(filename);
+	}
+}
 
-		std::getline(lineStream, item, ',');
-		int layer = std::stoi(item);
+void Index::loadBinary(std::string filename) {
+	std::unique_ptr<MappedFile> file(new MappedFile(filename));
+	const char *data = file->getData();
 
-		std::getline(lineStream, item, ',');
-		int neighboursCount = std::stoi(item);
+	DumpHeader header;
 
-		for (int i = 0; i < neighboursCount; ++i) {
-			std::getline(lineStream, item, ',');
-			nodes[nodeId]->layers[layer].push_back(nodes[std::stoi(item)]);
+	if (file->getSize() < sizeof(header)) {
+		throw std::runtime_error("Invalid dump " + filename);
+	}
+
+	std::copy(data, data + sizeof(header), reinterpret_cast<char*>(&header));
+
+	if (header.version < 1 || header.version > dumpVersion || header.scalarSize != sizeof(Scalar) || header.fileSize != file->getSize()) {
+		throw std::runtime_error("Incompatible dump " + filename);
+	}
+
+	// Inserts generate levels with these parameters, dumps converted from text by older versions may have garbage in them.
+	if (!(header.mL > 0) || !std::isfinite(header.mL) || (header.keepPrunedConnections != 0 && header.keepPrunedConnections != 1)) {
+		throw std::runtime_error("Invalid level generation parameters in dump " + filename + ", convert it again");
+	}
+
+	int nodesCount = header.nodesCount;
+	maxId = nodesCount - 1;
+	entryPoint = header.entryPoint;
+	descriptorSize = header.descriptorSize;
+	M = header.M;
+	M0 = header.M0;
+	efConstruction = header.efConstruction;
+	efSearch = header.efSearch;
+	keepPrunedConnections = header.keepPrunedConnections;
+	mL = header.mL;
+	logGeneration = header.logGeneration;
+
+	bindKernel();
+
+	descriptors = RowStore<Scalar>(descriptorSize, reinterpret_cast<Scalar*>(file->getData() + header.descriptorsOffset), nodesCount, cacheLineSize);
+	links0 = RowStore<int>(M0 + 2, reinterpret_cast<int*>(file->getData() + header.links0Offset), nodesCount);
+	nodes = RowStore<Node>(1, nodesCount);
+
+	if (descriptors.getStride() != header.descriptorStride) {
+		throw std::runtime_error("Incompatible dump " + filename);
+	}
+
+	const std::int32_t *levels = reinterpret_cast<const std::int32_t*>(data + header.levelsOffset);
+	const std::int32_t *upperLinks = reinterpret_cast<const std::int32_t*>(data + header.upperLinksOffset);
+	const std::uint64_t *nameOffsets = reinterpret_cast<const std::uint64_t*>(data + header.namesOffset);
+	const char *names = reinterpret_cast<const char*>(nameOffsets + nodesCount + 1);
+	// Dumps before version 3 have no removed nodes.
+	const std::uint8_t *states = header.statesOffset ? reinterpret_cast<const std::uint8_t*>(data + header.statesOffset) : nullptr;
+
+	for (int id = 0; id < nodesCount; ++id) {
+		Node *node = nodes.row(id);
+		node->maxLayer = levels[id];
+		node->name.assign(names + nameOffsets[id], names + nameOffsets[id + 1]);
+		node->state = states ? static_cast<NodeState>(states[id]) : NodeState::Live;
+
+		int upperLinksCount = std::max(0, node->maxLayer) * (M + 2);
+		node->upperLinks.assign(upperLinks, upperLinks + upperLinksCount);
+		upperLinks += upperLinksCount;
+
+		if (node->state == NodeState::Live) {
+			nameIds.emplace(node->name, id);
+		} else if (node->state == NodeState::Removed) {
+			++removedCount;
+		} else {
+			releasedIds.push_back(id);
 		}
 	}
+
+	dump = std::move(file);
 }
 
-Index::~Index() {
-	NodeList nodes = collectNodes();
+void Index::loadText(std::string filename) {
+	MappedFile file(filename);
+	const char *begin = file.getData();
+	const char *end = begin + file.getSize();
+
+	const char *headerEnd = findLineEnd(begin, end);
+	FieldReader header(begin, headerEnd);
+	int nodesCount;
+	int lastId;
+	int entry;
+
+	if (!header.readInt(nodesCount) || !header.readInt(lastId) || !header.readInt(entry) ||
+		!header.readInt(descriptorSize) || !header.readInt(M) || !header.readInt(M0) ||
+		!header.readInt(efConstruction) || !header.readInt(efSearch)) {
+		throw std::runtime_error("Invalid dump " + filename);
+	}
+
+	// Level generation parameters end the header, inserts after loading need them.
+	if (!header.empty()) {
+		int keepPruned;
 
-	for (const NodePtr &node : nodes) {
-		for (NodeList &layer : node->layers) {
-			layer.clear();
+		if (!header.readReal(mL) || !header.readInt(keepPruned) || !header.empty()) {
+			throw std::runtime_error("Invalid dump " + filename);
 		}
+
+		keepPrunedConnections = keepPruned != 0;
 	}
+
+	if (!(mL > 0) || !std::isfinite(mL)) {
+		throw std::runtime_error("Invalid dump " + filename);
+	}
+
+	maxId = lastId;
+	entryPoint = entry;
+	bindKernel();
+
+	initStores(lastId + 1);
+
+	for (int id = 0; id <= lastId; ++id) {
+		links0.row(id)[0] = 0;
+	}
+
+	const char *nodesBegin = skipLines(begin, end, 1);
+	const char *linksBegin = skipLines(nodesBegin, end, nodesCount);
+	const std::runtime_error error("Invalid dump " + filename);
+
+	ThreadPool threadPool;
+
+	forEachLine(threadPool, nodesBegin, linksBegin, [this, &error, lastId](const char *lineBegin, const char *lineEnd) {
+		FieldReader reader(lineBegin, lineEnd);
+		int id;
+
+		if (!reader.readInt(id) || id < 0 || id > lastId) {
+			throw error;
+		}
+
+		Node *node = nodes.row(id);
+		reader.readText(node->name);
+
+		Scalar *descriptor = descriptors.row(id);
+		double value;
+
+		for (int j = 0; j < descriptorSize; ++j) {
+			if (!reader.readReal(value) || !std::isfinite(value)) {
+				throw error;
+			}
+
+			descriptor[j] = static_cast<Scalar>(value);
+		}
+
+		int layersCount;
+
+		if (!reader.readInt(layersCount) || layersCount < 1) {
+			throw error;
+		}
+
+		node->maxLayer = layersCount - 1;
+		node->upperLinks.assign(node->maxLayer * (M + 2), 0);
+		node->state = NodeState::Live;
+	});
+
+	// Ids missing from the dump are free for inserts.
+	for (int id = 0; id <= lastId; ++id) {
+		Node *node = nodes.row(id);
+
+		if (node->state == NodeState::Live) {
+			nameIds.emplace(node->name, id);
+		} else {
+			node->state = NodeState::Released;
+			releasedIds.push_back(id);
+		}
+	}
+
+	forEachLine(threadPool, linksBegin, end, [this, &error, lastId](const char *lineBegin, const char *lineEnd) {
+		FieldReader reader(lineBegin, lineEnd);
+		int nodeId;
+		int layer;
+		int neighboursCount;
+
+		if (!reader.readInt(nodeId) || !reader.readInt(layer) || !reader.readInt(neighboursCount) ||
+			nodeId < 0 || nodeId > lastId || layer < 0 || layer > nodes.row(nodeId)->maxLayer) {
+			throw error;
+		}
+
+		int *block = links(nodeId, layer);
+		// Blocks have room for one link over the maximum, connect() adds it before pruning.
+		int maxM = (layer == 0) ? M0 : M;
+
+		for (int i = 0; i < neighboursCount; ++i) {
+			int neighbour;
+
+			if (!reader.readInt(neighbour) || neighbour < 0 || neighbour > lastId) {
+				throw error;
+			}
+
+			if (nodes.row(neighbour)->maxLayer >= layer && block[0] < maxM) {
+				block[++block[0]] = neighbour;
+			}
+		}
+	});
 }
@@ -6,94 +6,209 @@
 #include <random>
 #include <cmath>
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
 
-class Metric {
-public:
-	virtual double distance(const std::vector<double> &a, const std::vector<double> &b) = 0;
-};
+#include "storage.h"
+#include "distance.h"
 
-class Euclidean : public Metric {
-public:
-	double distance(const std::vector<double> &a, const std::vector<double> &b) override;
-};
+using Metric = Euclidean;
 
 struct Settings {
-	Metric *metric = new Euclidean();
 	int M = 16;
 	int M0 = 2 * M;
 	int efConstruction = 100;
 	int efSearch = 10;
 	double mL = 1.0 / std::log(M);
 	bool keepPrunedConnections = true;
+	int maxEfSearch = 1000;
+};
+
+// Binary dump starts with the header, sections at its offsets follow: descriptors, links of layer 0, levels,
+// links of upper layers, states and names.
+struct DumpHeader {
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t scalarSize;
+	std::int32_t nodesCount;
+	std::int32_t entryPoint;
+	std::int32_t descriptorSize;
+	std::int32_t M;
+	std::int32_t M0;
+	std::int32_t efConstruction;
+	std::int32_t efSearch;
+	std::int32_t keepPrunedConnections;
+	double mL;
+	std::uint64_t descriptorStride;
+	std::uint64_t descriptorsOffset;
+	std::uint64_t links0Offset;
+	std::uint64_t levelsOffset;
+	std::uint64_t upperLinksOffset;
+	std::uint64_t namesOffset;
+	std::uint64_t fileSize;
+	std::uint64_t logGeneration;
+	std::uint64_t statesOffset;
+};
+
+struct SearchParams {
+	int k = 1;
+	int ef = 0;
+	int maxEvaluations = 0;
+	bool withDescriptors = false;
+
+	SearchParams(int k = 1, int ef = 0, int maxEvaluations = 0) : k(k), ef(ef), maxEvaluations(maxEvaluations) {}
 };
 
 struct SearchResult {
 	std::string name;
-	std::vector<double> descriptor;
+	// Empty unless SearchParams::withDescriptors is set.
+	std::vector<Scalar> descriptor;
 	double distance;
 
-	SearchResult(std::string name, std::vector<double> descriptor, double distance) :
+	SearchResult(std::string name, double distance) : name(std::move(name)), distance(distance) {}
+
+	SearchResult(std::string name, std::vector<Scalar> descriptor, double distance) :
 		name(std::move(name)), descriptor(std::move(descriptor)), distance(distance) {}
 };
 
 class Index {
-	class Node;
+public:
+	class Snapshot;
+
+private:
+	struct Node;
 	struct NodeDistance;
+	struct KernelBinding;
+	class SearchContext;
+	class PooledContext;
+	class Traversal;
+
+	template<bool nearestFirst>
 	class NodeQueue;
 
-	using NodePtr = std::shared_ptr<Node>;
-	using NodeList = std::vector<NodePtr>;
+	// Removed nodes are still traversed until repair relinks their neighbours, released ids are reused by inserts.
+	enum class NodeState : unsigned char {Creating, Live, Removed, Released};
+
+	// Ids are signed 32-bit, so -1 marks a missing node: no entry point yet, no released id to reuse.
+	// Link blocks, dumps and RowStore indices use the same type, 2^31 nodes are beyond the memory of a server.
+	using NodeList = std::vector<int>;
+	using CandidateQueue = NodeQueue<true>;
+	using ResultQueue = NodeQueue<false>;
+
+	static const int linkMutexesCount = 1 << 12;
+
+	// Further lines of longer descriptors are left to the hardware prefetcher.
+	static const std::size_t maxDescriptorPrefetch = 8 * cacheLineSize;
+
+	static const char dumpMagic[8];
+	static const std::uint32_t dumpVersion = 3;
 
 	static std::mt19937 gen;
 	static std::uniform_real_distribution<double> dist;
 	static std::mutex randomMutex;
 
-	NodePtr entryPoint = NodePtr(nullptr);
-	int maxId = -1;
+	std::atomic<int> entryPoint{-1};
+	std::atomic<int> maxId{-1};
 
 	std::mutex entryMutex;
-	std::mutex idMutex;
 
 	int descriptorSize;
+	RowStore<Scalar> descriptors;
+	RowStore<int> links0;
+	RowStore<Node> nodes;
+	std::vector<std::mutex> linkMutexes = std::vector<std::mutex>(linkMutexesCount);
+
+	std::vector<std::unique_ptr<SearchContext>> contexts;
+	std::mutex contextsMutex;
+
+	std::unordered_multimap<std::string, int> nameIds;
+	std::mutex namesMutex;
+
+	std::atomic<int> removedCount{0};
+	NodeList pendingIds;
+	std::mutex repairMutex;
+
+	NodeList releasedIds;
+	std::mutex releasedMutex;
+
+	// Searches and inserts keep ids read from links, they are counted in the slot of the epoch they started in.
+	std::atomic<std::uint64_t> traversalEpoch{0};
+	std::atomic<int> traversalsCounts[2] = {{0}, {0}};
+
+	std::unique_ptr<MappedFile> dump;
+
+	// Distance kernel and search loops instantiated with it, bound once for the descriptor size and the CPU.
+	DistanceKernel distanceKernel;
+	void (Index::*layerSearch)(const Scalar *target, int entry, int searchCount, int layer, SearchContext &context);
 
-	Metric *metric;
 	int M;
 	int M0;
 	int efConstruction;
 	int efSearch;
+	int maxEfSearch;
 	double mL;
 	bool keepPrunedConnections;
+	std::uint32_t logGeneration = 0;
 
 	static double generateRand();
 
 	void move(Index &&other);
+	void bindKernel();
 
-	double distance(const NodePtr &a, const NodePtr &b);
+	double distance(const Scalar *a, int b);
+	double distance(int a, int b);
 
-	NodePtr getEntryPoint();
-	void setEntryPoint(const NodePtr &newEntryPoint);
+	int getEntryPoint();
+	void setEntryPoint(int newEntryPoint);
 
-	int getSize();
 	int generateId();
+	int takeReleasedId();
+	bool isLive(int id);
+
+	void initStores(int capacity);
+
+	int createNode(std::string name, const Scalar *descriptor, int layer);
 
-	NodePtr createNode(std::string name, std::vector<double> descriptor, int layer);
+	int* links(int id, int layer);
+	std::mutex& linkMutex(int id);
+	void readLinks(int id, int layer, NodeList &result);
+	void readLinks(const Snapshot &snapshot, int id, int layer, NodeList &result);
 
-	void searchAtLayer(const NodePtr &target, const NodePtr &entry, int searchCount, int layer,
-		NodeQueue &candidates, bool *visited, int candidatesCount, NodeQueue &result);
+	int enterTraversal();
+	void leaveTraversal(int slot);
+	// Returns after all traversals, which started before the call, have ended.
+	void waitForTraversals();
 
-	void selectNeighbours(const NodePtr &target, int count, int layer,
-		NodeQueue &candidates, NodeList &discarded, NodeList &result);
+	std::unique_ptr<SearchContext> acquireContext();
+	void releaseContext(std::unique_ptr<SearchContext> context);
 
-	void load(std::string filename, Metric *metric = new Euclidean());
+	void connect(int id, int neighbour, int layer, SearchContext &context);
+	void repairLinks(int id, int layer, SearchContext &context);
+	int findEntryPoint(int nodesCount);
+	NodeList orderNodes(const Snapshot &snapshot, int entry);
 
-	NodeList collectNodes();
+	void searchAtLayer(const Scalar *target, int entry, int searchCount, int layer, SearchContext &context);
+
+	template<class Kernel>
+	void searchAtLayerWith(const Scalar *target, int entry, int searchCount, int layer, SearchContext &context);
+
+	void selectNeighbours(int count, const std::vector<NodeDistance> &candidates, NodeList &discarded, NodeList &result);
+
+	void load(std::string filename);
+	void loadBinary(std::string filename);
+	void loadText(std::string filename);
 
 public:
 	Index(int descriptorSize, Settings settings = Settings());
 
-	Index(std::string dumpName, Metric *metric = new Euclidean()) {
-		load(dumpName, metric);
+	// Graph parameters are read from the dump, settings only provide search limits
+	// and the level generation parameters, if a text dump doesn't have them.
+	explicit Index(std::string dumpName, Settings settings = Settings()) :
+		maxEfSearch(settings.maxEfSearch), mL(settings.mL), keepPrunedConnections(settings.keepPrunedConnections) {
+		load(dumpName);
 	}
 
 	Index(const Index&) = delete;
@@ -102,95 +217,201 @@ public:
 	Index(Index &&other);
 	Index& operator=(Index &&other);
 
-	~Index();
-
 	int getDescriptorSize() {
 		return descriptorSize;
 	}
 
-	void insert(std::string name, std::vector<double> descriptor);
-	std::vector<SearchResult> search(std::vector<double> descriptor, int k);
+	int getSize();
+
+	// Dump contains inserts of all insert logs older than this generation.
+	std::uint32_t getLogGeneration() {
+		return logGeneration;
+	}
+
+	void insert(std::string name, const std::vector<Scalar> &descriptor);
+	// Descriptor points to descriptor size values.
+	void insert(std::string name, const Scalar *descriptor);
+
+	// Removes all images with the name from search results, returns count of removed nodes.
+	int remove(const std::string &name);
+
+	// Whether an image with the name is in search results.
+	bool contains(const std::string &name);
+
+	// Relinks neighbours of removed nodes and releases ids, which were removed before the previous repair.
+	// Returns count of nodes, which changed their state.
+	int repair();
+
+	// Throws if parameters are out of the bounds set by settings.
+	void checkSearchParams(const SearchParams &params);
+
+	// ef = 0 searches with efSearch from settings, maxEvaluations = 0 doesn't limit distance evaluations.
+	std::vector<SearchResult> search(const std::vector<Scalar> &descriptor, const SearchParams &params = SearchParams());
+
+	Snapshot snapshot(std::uint32_t generation);
 
 	void save(std::string filename);
+	// Saves nodes of the snapshot, while inserts of newer nodes may go on.
+	void save(std::string filename, const Snapshot &snapshot);
 };
 
-class Index::Node {
-public:
-	std::vector<NodeList> layers;
-	std::vector<std::mutex> layersMutexes;
-	int maxLayer = -1;
-	int id = -1;
-	std::string name;
-	std::vector<double> descriptor;
+// Set of nodes existing at its creation. Released ids aren't reused while it exists, so nodes can't change under it.
+// Inserts prune links of existing nodes, so links are copied at the creation, blocks of a node follow each other.
+class Index::Snapshot {
+	friend class Index;
+
+	std::unique_lock<std::mutex> reuseLock;
+	int nodesCount;
+	int entryPoint;
+	std::uint32_t generation;
 
-	Node(int id, std::string name, std::vector<double> descriptor, int layersCount, int neighboursCount, int neighboursCount0);
-	Node(std::vector<double> descriptor) : descriptor(std::move(descriptor)) {}
+	NodeList links;
+	std::vector<std::size_t> linksOffsets;
 
-	void addNeighbour(const NodePtr &neighbour, int layer);
+	Snapshot(Index &index, std::uint32_t generation);
+};
+
+// Upper layers are rare, so their link blocks live with the node instead of in fixed-size rows.
+struct Index::Node {
+	std::string name;
+	int maxLayer = -1;
+	std::vector<int> upperLinks;
+	std::atomic<NodeState> state{NodeState::Creating};
 };
 
 struct Index::NodeDistance {
 	double distance;
-	NodePtr node;
+	int id;
 
-	NodeDistance(double distance, const NodePtr &node) : distance(distance), node(node) {}
+	NodeDistance(double distance, int id) : distance(distance), id(id) {}
 };
 
+template<bool nearestFirst>
 class Index::NodeQueue {
 	class DistanceComparator {
 	public:
 		bool operator()(const NodeDistance &a, const NodeDistance &b) {
-			return a.distance > b.distance;
+			return nearestFirst ? a.distance > b.distance : a.distance < b.distance;
 		}
 	};
 
 	std::vector<NodeDistance> container;
 
 public:
-	void push(NodeDistance item);
-	void emplace(double distance, const NodePtr &node);
-	void popNearest();
-	void popFurthest();
+	void emplace(double distance, int id) {
+		container.emplace_back(distance, id);
+		std::push_heap(container.begin(), container.end(), DistanceComparator());
+	}
 
-	const NodeDistance& nearest() {
+	void pop() {
+		std::pop_heap(container.begin(), container.end(), DistanceComparator());
+		container.pop_back();
+	}
+
+	const NodeDistance& top() {
 		return container.front();
 	}
 
-	const NodeDistance& furthest() {
-		return container.back();
+	// Destroys the heap order, the queue must be cleared before next use.
+	const std::vector<NodeDistance>& sort() {
+		std::sort(container.begin(), container.end(), [](const NodeDistance &a, const NodeDistance &b) {
+			return a.distance < b.distance;
+		});
+
+		return container;
 	}
 
 	int size() {
 		return container.size();
 	}
 
-	int capacity() {
-		return container.capacity();
-	}
-
 	bool empty() {
 		return container.empty();
 	}
 
-	const NodeDistance& operator[](int index) {
-		return container[index];
+	void reserve(int size) {
+		container.reserve(size);
 	}
 
-	std::vector<NodeDistance>::const_iterator begin() const {
-		return container.cbegin();
+	void clear() {
+		container.clear();
 	}
+};
+
+// Scratch space of a single insert or search, reused through the index pool.
+// Nodes are visited when their mark equals the current tag, so starting a new search only bumps the tag.
+class Index::SearchContext {
+	std::vector<unsigned short> visited;
+	unsigned short visitedTag = 0;
 
-	std::vector<NodeDistance>::const_iterator end() const {
-		return container.cend();
+public:
+	CandidateQueue candidates;
+	ResultQueue results;
+	std::vector<NodeDistance> sortedNeighbours;
+	NodeList neighbours;
+	NodeList discarded;
+	NodeList selected;
+	NodeList linksCopy;
+	NodeList unvisited;
+	int evaluationsLeft;
+
+	SearchContext(int searchCount, int neighboursCount);
+
+	void prepare(int nodesCount);
+	void startVisit();
+
+	void prefetchVisit(int id) {
+		if (id < visited.size()) {
+			prefetch(&visited[id]);
+		}
 	}
 
-	void reserve(int size) {
-		container.reserve(size);
+	bool visit(int id) {
+		if (id >= visited.size() || visited[id] == visitedTag) {
+			return false;
+		}
+
+		visited[id] = visitedTag;
+		return true;
 	}
+};
 
-	void clear() {
-		container.clear();
+class Index::PooledContext {
+	Index &index;
+	std::unique_ptr<SearchContext> context;
+
+public:
+	PooledContext(Index &index) : index(index), context(index.acquireContext()) {}
+
+	~PooledContext() {
+		index.releaseContext(std::move(context));
 	}
+
+	PooledContext(const PooledContext&) = delete;
+	PooledContext& operator=(const PooledContext&) = delete;
+
+	SearchContext& operator*() {
+		return *context;
+	}
+
+	SearchContext* operator->() {
+		return context.get();
+	}
+};
+
+class Index::Traversal {
+	Index &index;
+	int slot;
+
+public:
+	Traversal(Index &index) : index(index), slot(index.enterTraversal()) {}
+
+	~Traversal() {
+		index.leaveTraversal(slot);
+	}
+
+	Traversal(const Traversal&) = delete;
+	Traversal& operator=(const Traversal&) = delete;
 };
 
 #endif
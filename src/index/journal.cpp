@@ -0,0 +1,326 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "journal.h"
+#include "parser.h"
+#include "thread_pool.h"
+
+InsertLog::InsertLog(std::string path, int syncInterval) : path(path), file(path), syncInterval(syncInterval) {
+	writer = std::thread([this]() {
+		write();
+	});
+}
+
+InsertLog::~InsertLog() {
+	std::unique_lock<std::mutex> lock(mutex);
+	isRunning = false;
+	lock.unlock();
+
+	appendCV.notify_one();
+	writer.join();
+}
+
+void InsertLog::write() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		appendCV.wait(lock, [this]() {
+			return !pending.empty() || !isRunning;
+		});
+
+		if (pending.empty()) {
+			break;
+		}
+
+		// Gives concurrent inserts a chance to share the sync.
+		if (isRunning && syncInterval > 0) {
+			appendCV.wait_for(lock, std::chrono::milliseconds(syncInterval), [this]() {
+				return !isRunning;
+			});
+		}
+
+		std::string records;
+		records.swap(pending);
+		std::uint64_t last = appended;
+
+		lock.unlock();
+		bool isWritten = file.write(records.data(), records.size()) && file.sync();
+		lock.lock();
+
+		isFailed = isFailed || !isWritten;
+		synced = last;
+
+		syncCV.notify_all();
+	}
+}
+
+void InsertLog::append(const std::string &record) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (!isFailed) {
+		pending += record;
+		std::uint64_t number = ++appended;
+
+		appendCV.notify_one();
+		syncCV.wait(lock, [this, number]() {
+			return synced >= number;
+		});
+	}
+
+	if (isFailed) {
+		throw std::runtime_error("Can't write insert log " + path);
+	}
+}
+
+std::string InsertLog::getPath(const std::string &dumpPath, std::uint32_t generation) {
+	return dumpPath + ".log." + std::to_string(generation);
+}
+
+static bool fileExists(const std::string &path) {
+	return std::ifstream(path).good();
+}
+
+static std::string formatItem(const std::string &name, const std::vector<Scalar> &descriptor) {
+	return name + ',' + formatDescriptor(descriptor) + '\n';
+}
+
+Journal::Journal(ShardedIndex &index, std::string dumpPath, int syncInterval, int snapshotInterval) :
+	index(index), dumpPath(std::move(dumpPath)), syncInterval(syncInterval) {
+	generation = index.getLogGeneration();
+	removeLogs(generation);
+
+	for (; fileExists(InsertLog::getPath(this->dumpPath, generation)); ++generation) {
+		replay(InsertLog::getPath(this->dumpPath, generation), generation);
+		hasChanges = true;
+	}
+
+	log.reset(new InsertLog(InsertLog::getPath(this->dumpPath, generation), syncInterval));
+
+	if (snapshotInterval > 0) {
+		snapshotter = std::thread([this, snapshotInterval]() {
+			std::unique_lock<std::mutex> lock(mutex);
+
+			while (!stopCV.wait_for(lock, std::chrono::seconds(snapshotInterval), [this]() { return !isRunning; })) {
+				lock.unlock();
+
+				try {
+					if (this->index.repair() > 0) {
+						lock.lock();
+						hasChanges = true;
+						lock.unlock();
+					}
+
+					snapshot();
+				} catch (const std::exception &e) {
+					std::cout << "Snapshot failed: " << e.what() << std::endl;
+				}
+
+				lock.lock();
+			}
+		});
+	}
+}
+
+Journal::~Journal() {
+	std::unique_lock<std::mutex> lock(mutex);
+	isRunning = false;
+	lock.unlock();
+
+	stopCV.notify_all();
+
+	if (snapshotter.joinable()) {
+		snapshotter.join();
+	}
+}
+
+void Journal::replay(const std::string &path, std::uint32_t logGeneration) {
+	std::cout << "Replaying " << path << "..." << std::endl;
+
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream content;
+	content << file.rdbuf();
+
+	std::string records = content.str();
+	const char *begin = records.data();
+	std::string::size_type lastLineEnd = records.find_last_of('\n');
+
+	// Record without line end was torn by a crash before it was synced, so it was never applied.
+	if (lastLineEnd == std::string::npos) {
+		return;
+	}
+
+	ThreadPool threadPool;
+	int descriptorSize = index.getDescriptorSize();
+
+	// Dumps of shards are replaced one by one, so some of them may already hold changes of the log.
+	auto isFolded = [this, logGeneration](const std::string &name) {
+		return index.getLogGeneration(index.getShard(name)) > logGeneration;
+	};
+
+	LineAction insert = [this, &path, descriptorSize, &isFolded](const char *lineBegin, const char *lineEnd) {
+		std::string name;
+		std::vector<Scalar> descriptor;
+
+		try {
+			descriptor = parseItem(lineBegin, lineEnd, descriptorSize, name);
+		} catch (const std::runtime_error &e) {
+			throw std::runtime_error("Invalid insert log " + path + ": " + e.what());
+		}
+
+		if (!isFolded(name)) {
+			index.insert(std::move(name), descriptor);
+		}
+	};
+
+	const char *end = begin + lastLineEnd + 1;
+
+	while (begin < end) {
+		// Inserts are applied in parallel up to the next removal record, which has no descriptor.
+		const char *insertsEnd = begin;
+
+		for (const char *lineEnd; insertsEnd < end; insertsEnd = lineEnd + 1) {
+			lineEnd = findLineEnd(insertsEnd, end);
+
+			if (lineEnd > insertsEnd && !memchr(insertsEnd, ',', lineEnd - insertsEnd)) {
+				break;
+			}
+		}
+
+		forEachLine(threadPool, begin, insertsEnd, insert);
+
+		if (insertsEnd < end) {
+			const char *lineEnd = findLineEnd(insertsEnd, end);
+			std::string name(insertsEnd, lineEnd);
+
+			if (!isFolded(name)) {
+				index.remove(name);
+			}
+
+			insertsEnd = lineEnd + 1;
+		}
+
+		begin = insertsEnd;
+	}
+}
+
+void Journal::removeLogs(std::uint32_t untilGeneration) {
+	for (std::uint32_t oldGeneration = untilGeneration; oldGeneration > 0; --oldGeneration) {
+		if (std::remove(InsertLog::getPath(dumpPath, oldGeneration - 1).c_str()) != 0) {
+			break;
+		}
+	}
+}
+
+void Journal::snapshot() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (!hasChanges) {
+		return;
+	}
+
+	isPaused = true;
+
+	writeCV.wait(lock, [this]() {
+		return writing == 0;
+	});
+
+	// New changes go to the next log, so the snapshot holds exactly the changes of older logs.
+	log.reset(new InsertLog(InsertLog::getPath(dumpPath, generation + 1), syncInterval));
+	std::uint32_t snapshotGeneration = ++generation;
+	ShardedIndex::Snapshot nodes = index.snapshot(snapshotGeneration);
+
+	hasChanges = false;
+	isPaused = false;
+
+	lock.unlock();
+	writeCV.notify_all();
+
+	std::string snapshotPath = dumpPath + ".tmp";
+
+	try {
+		index.save(snapshotPath, nodes);
+
+		for (int shard = 0; shard < index.getShardsCount(); ++shard) {
+			std::string shardSnapshotPath = ShardedIndex::getDumpPath(snapshotPath, shard, index.getShardsCount());
+			std::string shardDumpPath = ShardedIndex::getDumpPath(dumpPath, shard, index.getShardsCount());
+
+			if (!syncFile(shardSnapshotPath) || !replaceFile(shardSnapshotPath, shardDumpPath)) {
+				throw std::runtime_error("Can't replace dump " + shardDumpPath);
+			}
+		}
+	} catch (...) {
+		lock.lock();
+		hasChanges = true;
+
+		throw;
+	}
+
+	removeLogs(snapshotGeneration);
+}
+
+void Journal::write(const std::string &record, const std::function<void()> &apply) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	writeCV.wait(lock, [this]() {
+		return !isPaused;
+	});
+
+	++writing;
+	hasChanges = true;
+	lock.unlock();
+
+	try {
+		log->append(record);
+		apply();
+	} catch (...) {
+		lock.lock();
+		--writing;
+		lock.unlock();
+
+		writeCV.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	--writing;
+	lock.unlock();
+
+	writeCV.notify_all();
+}
+
+static void checkName(const std::string &name) {
+	if (name.find_first_of(",\r\n") != std::string::npos) {
+		throw std::runtime_error("Name can't contain commas and line breaks");
+	}
+}
+
+void Journal::insert(std::string name, const std::vector<Scalar> &descriptor) {
+	checkName(name);
+
+	write(formatItem(name, descriptor), [this, &name, &descriptor]() {
+		index.insert(std::move(name), descriptor);
+	});
+}
+
+int Journal::remove(const std::string &name) {
+	checkName(name);
+
+	if (name.empty()) {
+		return 0;
+	}
+
+	int count = 0;
+
+	write(name + '\n', [this, &name, &count]() {
+		count = index.remove(name);
+	});
+
+	return count;
+}
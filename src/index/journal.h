@@ -0,0 +1,86 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "sharded_index.h"
+#include "storage.h"
+
+// Append-only log of inserted items and removed names. Records of concurrent appends are written and synced together.
+class InsertLog {
+	std::string path;
+	AppendFile file;
+	int syncInterval;
+
+	std::string pending;
+	std::uint64_t appended = 0;
+	std::uint64_t synced = 0;
+	bool isRunning = true;
+	bool isFailed = false;
+
+	std::mutex mutex;
+	std::condition_variable appendCV;
+	std::condition_variable syncCV;
+	std::thread writer;
+
+	void write();
+
+public:
+	InsertLog(std::string path, int syncInterval);
+	~InsertLog();
+
+	InsertLog(const InsertLog&) = delete;
+	InsertLog& operator=(const InsertLog&) = delete;
+
+	// Returns after the record is on the disk.
+	void append(const std::string &record);
+
+	static std::string getPath(const std::string &dumpPath, std::uint32_t generation);
+};
+
+// Makes online inserts and removals durable. Changes are logged before they are applied, logs are replayed on startup
+// and periodically folded into a new dump, which is written in background and replaces the old one by rename.
+class Journal {
+	ShardedIndex &index;
+	std::string dumpPath;
+	int syncInterval;
+
+	std::uint32_t generation;
+	std::unique_ptr<InsertLog> log;
+	bool hasChanges = false;
+
+	int writing = 0;
+	bool isPaused = false;
+	bool isRunning = true;
+
+	std::mutex mutex;
+	std::condition_variable writeCV;
+	std::condition_variable stopCV;
+	std::thread snapshotter;
+
+	void write(const std::string &record, const std::function<void()> &apply);
+
+	void replay(const std::string &path, std::uint32_t logGeneration);
+	void removeLogs(std::uint32_t untilGeneration);
+	void snapshot();
+
+public:
+	// snapshotInterval = 0 disables snapshots and repair, logs are folded only on the next start.
+	Journal(ShardedIndex &index, std::string dumpPath, int syncInterval, int snapshotInterval);
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	void insert(std::string name, const std::vector<Scalar> &descriptor);
+	int remove(const std::string &name);
+};
+
+#endif
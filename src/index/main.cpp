@@ -1,95 +1,324 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include <exception>
 #include <stdexcept>
 #include <unordered_map>
+#include <memory>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
 
 #include "index.h"
+#include "sharded_index.h"
 #include "thread_pool.h"
+#include "parser.h"
+#include "journal.h"
+#include "image_cache.h"
+#include "search_cache.h"
+#include "remote_shards.h"
+#include "bounded_queue.h"
 #include "arguments.h"
 #include "httplib.h"
 
-std::vector<double> parseDescriptor(std::istream &in, int descriptorSize) {
-	std::vector<double> descriptor;
-	descriptor.reserve(descriptorSize);
-	std::string item;
+// Body holds descriptor size little-endian float32 values.
+std::vector<Scalar> parseBinaryDescriptor(const char *data, std::size_t size, int descriptorSize) {
+	if (size != descriptorSize * sizeof(float)) {
+		throw std::runtime_error("Incorrect descriptor size");
+	}
 
-	try {
-		while (getline(in, item, ',')) {
-			descriptor.push_back(std::stod(item));
+	std::vector<Scalar> descriptor(descriptorSize);
+	const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+
+	for (int i = 0; i < descriptorSize; ++i, bytes += sizeof(float)) {
+		std::uint32_t bits = std::uint32_t(bytes[0]) | std::uint32_t(bytes[1]) << 8 |
+			std::uint32_t(bytes[2]) << 16 | std::uint32_t(bytes[3]) << 24;
+		float value;
+
+		std::memcpy(&value, &bits, sizeof(value));
+
+		if (!std::isfinite(value)) {
+			throw std::runtime_error("Invalid value");
 		}
-	} catch (const std::invalid_argument&) {
-		throw std::runtime_error("Invalid value");
-	} catch (const std::out_of_range&) {
-		throw std::runtime_error("Value is out of range");
-	}
 
-	if (descriptor.size() != descriptorSize) {
-		throw std::runtime_error("Incorrect descriptor size");
+		descriptor[i] = value;
 	}
 
 	return descriptor;
 }
 
-void parseAndInsert(std::string line, Index &index, int descriptorSize) {
-	std::istringstream lineStream(line);
-
+void parseAndInsert(const char *begin, const char *end, ShardedIndex &index, int descriptorSize) {
 	std::string name;
-	getline(lineStream, name, ',');
+	std::vector<Scalar> descriptor = parseItem(begin, end, descriptorSize, name);
+
+	index.insert(std::move(name), descriptor);
+}
+
+// Text body holds a descriptor per line, binary body holds descriptors one after another.
+std::vector<std::vector<Scalar>> parseDescriptors(const httplib::Request &req, int descriptorSize) {
+	std::vector<std::vector<Scalar>> descriptors;
+	const char *begin = req.body.data();
+	const char *end = begin + req.body.size();
+
+	if (req.get_header_value("Content-Type").find("application/octet-stream") == 0) {
+		std::size_t rowSize = descriptorSize * sizeof(float);
+
+		if (req.body.size() % rowSize != 0) {
+			throw std::runtime_error("Incorrect descriptor size");
+		}
+
+		for (const char *row = begin; row < end; row += rowSize) {
+			descriptors.push_back(parseBinaryDescriptor(row, rowSize, descriptorSize));
+		}
+	} else {
+		while (begin < end) {
+			const char *lineEnd = findLineEnd(begin, end);
+			FieldReader reader(begin, lineEnd);
+
+			if (!reader.empty()) {
+				descriptors.push_back(parseDescriptor(reader, descriptorSize));
+			}
+
+			begin = skipLines(begin, end, 1);
+		}
+	}
+
+	return descriptors;
+}
+
+void parseItems(const std::string &body, int descriptorSize, std::vector<std::string> &names, std::vector<std::vector<Scalar>> &descriptors) {
+	const char *begin = body.data();
+	const char *end = begin + body.size();
+
+	while (begin < end) {
+		const char *lineEnd = findLineEnd(begin, end);
+
+		if (!FieldReader(begin, lineEnd).empty()) {
+			names.emplace_back();
+			descriptors.push_back(parseItem(begin, lineEnd, descriptorSize, names.back()));
+
+			if (names.back().empty()) {
+				throw std::runtime_error("Empty name");
+			}
+		}
 
-	std::vector<double> descriptor = parseDescriptor(lineStream, descriptorSize);
+		begin = skipLines(begin, end, 1);
+	}
+}
 
-	index.insert(std::move(name), std::move(descriptor));
+void runBatch(ThreadPool &threadPool, int count, const std::function<void(int)> &action) {
+	threadPool.parallelFor(count, [&action](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			action(i);
+		}
+	});
 }
 
-Index createIndex(Settings settings, std::string dataPath, std::string dumpPath, int baseSize) {
-	std::ifstream dumpFile(dumpPath);
+struct ParsedChunk {
+	std::vector<std::string> names;
+	// Descriptors of all items one after another.
+	std::vector<Scalar> descriptors;
+};
+
+// Parser threads turn line chunks into items and insert threads link them into the graph.
+// The queue between them is bounded, so parsed data waiting for insertion stays small.
+void insertPipelined(ShardedIndex &index, const char *begin, const char *end) {
+	static const std::size_t chunkBytes = 1 << 18;
+
+	int descriptorSize = index.getDescriptorSize();
+	int threadCount = std::thread::hardware_concurrency();
+	threadCount = threadCount ? threadCount : 4;
+	int parsersCount = std::max(1, threadCount / 4);
+
+	std::vector<TextRange> chunks = splitLines(begin, end, std::max<std::size_t>(threadCount * 4, (end - begin) / chunkBytes));
+	std::atomic<int> nextChunk(0);
+	std::atomic<int> parsersLeft(parsersCount);
+	BoundedQueue<ParsedChunk> parsedChunks(threadCount * 2);
+
+	std::exception_ptr error;
+	std::atomic<bool> isFailed(false);
+	std::mutex errorMutex;
 
-	if (dumpFile.good()) {
-		dumpFile.close();
+	auto fail = [&]() {
+		std::unique_lock<std::mutex> lock(errorMutex);
 
+		if (!error) {
+			error = std::current_exception();
+		}
+
+		isFailed = true;
+		parsedChunks.close();
+	};
+
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < parsersCount; ++i) {
+		threads.emplace_back([&]() {
+			try {
+				for (int chunk = nextChunk++; chunk < chunks.size() && !isFailed; chunk = nextChunk++) {
+					ParsedChunk parsed;
+					const char *line = chunks[chunk].begin;
+
+					while (line < chunks[chunk].end) {
+						const char *lineEnd = findLineEnd(line, chunks[chunk].end);
+
+						if (!FieldReader(line, lineEnd).empty()) {
+							parsed.names.emplace_back();
+							parsed.descriptors.resize(parsed.descriptors.size() + descriptorSize);
+							parseItem(line, lineEnd, descriptorSize, parsed.names.back(), parsed.descriptors.data() + parsed.descriptors.size() - descriptorSize);
+						}
+
+						line = lineEnd + 1;
+					}
+
+					if (!parsedChunks.push(std::move(parsed))) {
+						break;
+					}
+				}
+			} catch (...) {
+				fail();
+			}
+
+			if (--parsersLeft == 0) {
+				parsedChunks.close();
+			}
+		});
+	}
+
+	for (int i = 0; i < threadCount; ++i) {
+		threads.emplace_back([&]() {
+			try {
+				ParsedChunk parsed;
+
+				while (!isFailed && parsedChunks.pop(parsed)) {
+					for (int item = 0; item < parsed.names.size(); ++item) {
+						index.insert(std::move(parsed.names[item]), parsed.descriptors.data() + item * descriptorSize);
+					}
+				}
+			} catch (...) {
+				fail();
+			}
+		});
+	}
+
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+ShardedIndex createIndex(Settings settings, std::string dataPath, std::string dumpPath, int baseSize, int shardsCount) {
+	if (ShardedIndex::hasDump(dumpPath, shardsCount)) {
 		std::cout << "Reading dump..." << std::endl;
 
-		return Index(dumpPath);
+		return ShardedIndex(dumpPath, shardsCount, settings);
 	}
 
 	std::cout << "Indexing..." << std::endl;
 
-	std::ifstream dataFile(dataPath);
+	std::unique_ptr<MappedFile> dataFile;
 
-	if (dataFile.fail()) {
+	try {
+		dataFile.reset(new MappedFile(dataPath));
+	} catch (const std::runtime_error&) {
 		throw std::runtime_error("Can't find neither data file nor dump file");
 	}
 
-	std::string line;
+	const char *begin = dataFile->getData();
+	const char *end = begin + dataFile->getSize();
 
-	getline(dataFile, line);
+	FieldReader header(begin, findLineEnd(begin, end));
+	int descriptorSize;
 
-	int descriptorSize = std::stoi(line);
-	Index index(descriptorSize, settings);
+	if (!header.readInt(descriptorSize)) {
+		throw std::runtime_error("Invalid data file");
+	}
+
+	{
+		ShardedIndex index(descriptorSize, shardsCount, settings);
+
+		const char *position = skipLines(begin, end, 1);
+
+		for (int i = 0; i < baseSize && position < end; ++i) {
+			const char *lineEnd = findLineEnd(position, end);
+			parseAndInsert(position, lineEnd, index, descriptorSize);
+			position = skipLines(position, end, 1);
+		}
+
+		if (position < end) {
+			insertPipelined(index, position, end);
+		}
 
-	for (int i = 0; i < baseSize && std::getline(dataFile, line); ++i) {
-		parseAndInsert(line, index, descriptorSize);
+		index.save(dumpPath);
 	}
 
-	if (!dataFile.eof()) {
-		ThreadPool threadPool;
+	// Built nodes are in insertion order, the dump has them reordered by graph neighbourhood.
+	return ShardedIndex(dumpPath, shardsCount, settings);
+}
 
-		while (std::getline(dataFile, line)) {
-			threadPool.enqueu([line, &index, descriptorSize]() {
-				parseAndInsert(line, index, descriptorSize);
-			});
+// Example: [{"name":"a.jpg","distance":0.52},{"name":"b.jpg","distance":0.61}]
+std::string formatJsonResults(const std::vector<SearchResult> &results) {
+	std::string content = "[";
+	char text[32];
+
+	for (int i = 0; i < results.size(); ++i) {
+		content += i > 0 ? ",{\"name\":\"" : "{\"name\":\"";
+
+		for (char c : results[i].name) {
+			if (c == '"' || c == '\\') {
+				content += '\\';
+				content += c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				std::snprintf(text, sizeof(text), "\\u%04x", c);
+				content += text;
+			} else {
+				content += c;
+			}
 		}
 
-		threadPool.wait();
+		std::snprintf(text, sizeof(text), "%.7g", results[i].distance);
+		content += "\",\"distance\":";
+		content += text;
+		content += '}';
 	}
 
-	index.save(dumpPath);
+	content += ']';
 
-	return index;
+	return content;
+}
+
+// Record per result: little-endian float32 distance, uint32 name size and name bytes.
+std::string formatBinaryResults(const std::vector<SearchResult> &results) {
+	std::string content;
+
+	auto writeWord = [&content](std::uint32_t word) {
+		for (int shift = 0; shift < 32; shift += 8) {
+			content += static_cast<char>((word >> shift) & 0xff);
+		}
+	};
+
+	for (const SearchResult &result : results) {
+		float distance = static_cast<float>(result.distance);
+		std::uint32_t bits;
+
+		std::memcpy(&bits, &distance, sizeof(bits));
+		writeWord(bits);
+		writeWord(result.name.size());
+		content += result.name;
+	}
+
+	return content;
 }
 
 std::string pickContentType(std::string fileName) {
@@ -121,7 +350,47 @@ std::string pickContentType(std::string fileName) {
 	}
 }
 
-void setServerRoutes(httplib::Server &server, Index &index, const std::string &dataset) {
+// Line per query with comma-separated pairs of image name and distance.
+std::string formatTextResults(const std::vector<std::vector<SearchResult>> &results) {
+	std::string content;
+	char distance[32];
+
+	for (const std::vector<SearchResult> &queryResults : results) {
+		for (int i = 0; i < queryResults.size(); ++i) {
+			std::snprintf(distance, sizeof(distance), "%.7g", queryResults[i].distance);
+
+			content += i > 0 ? "," : "";
+			content += queryResults[i].name;
+			content += ',';
+			content += distance;
+		}
+
+		content += '\n';
+	}
+
+	return content;
+}
+
+void sendImage(httplib::Response &res, ImageCache &images, const std::string &name) {
+	std::shared_ptr<const MappedFile> image;
+
+	try {
+		image = images.get(name);
+	} catch (const std::exception&) {
+		res.status = 500;
+		res.set_content("Can't find an image in the dataset", "text/plain");
+		return;
+	}
+
+	// Image is written to the socket straight from the mapping.
+	res.set_content_provider(image->getSize(), pickContentType(name).c_str(),
+		[image](std::size_t offset, std::size_t length, httplib::DataSink &sink) {
+			return sink.write(image->getData() + offset, length);
+		});
+	res.set_header("Name", name.c_str());
+}
+
+void setServerRoutes(httplib::Server &server, ShardedIndex &index, Journal &journal, ThreadPool &batchPool, ImageCache &images, SearchCache &searchCache) {
 	server.Get("/health", [](const httplib::Request&, httplib::Response &res) {
 		res.set_content("I'm OK", "text/plain");
 	});
@@ -130,63 +399,355 @@ void setServerRoutes(httplib::Server &server, Index &index, const std::string &d
 		res.set_content(std::to_string(index.getDescriptorSize()), "text/plain");
 	});
 
-	server.Post("/neighbour", [&index, &dataset](const httplib::Request &req, httplib::Response &res) {
-		std::istringstream bodyStream(req.body);
-		std::vector<double> descriptor;
+	server.Post("/neighbour", [&index, &images, &searchCache](const httplib::Request &req, httplib::Response &res) {
+		std::vector<Scalar> descriptor;
+		SearchParams params;
+
+		std::string format = req.has_param("format") ? req.get_param_value("format") : "image";
 
 		try {
-			descriptor = parseDescriptor(bodyStream, index.getDescriptorSize());
+			params = parseSearchParams(req.params);
+			index.checkSearchParams(params);
+
+			if (format != "image" && format != "json" && format != "binary") {
+				throw std::runtime_error("Invalid format");
+			}
+
+			if (req.get_header_value("Content-Type").find("application/octet-stream") == 0) {
+				descriptor = parseBinaryDescriptor(req.body.data(), req.body.size(), index.getDescriptorSize());
+			} else {
+				FieldReader bodyReader(req.body.data(), req.body.data() + req.body.size());
+				descriptor = parseDescriptor(bodyReader, index.getDescriptorSize());
+			}
 		} catch (const std::exception &e) {
 			res.status = 400;
 			res.set_content(e.what(), "text/plain");
 			return;
 		}
 
-		std::vector<SearchResult> searchResults = index.search(std::move(descriptor), 1);
+		std::vector<SearchResult> searchResults = searchCache.search(descriptor, params);
+
+		// Results-only responses don't touch the dataset.
+		if (format == "json") {
+			res.set_content(formatJsonResults(searchResults), "application/json");
+			return;
+		}
+
+		if (format == "binary") {
+			res.set_content(formatBinaryResults(searchResults), "application/octet-stream");
+			return;
+		}
 
 		if (searchResults.empty()) {
 			res.set_content("Index is empty", "text/plain");
 			return;
 		}
 
-		SearchResult searchResult = searchResults.front();
+		sendImage(res, images, searchResults.front().name);
+	});
+
+	server.Get("/image", [&index, &images](const httplib::Request &req, httplib::Response &res) {
+		std::string name = req.get_param_value("name");
+
+		// Only indexed images are served, so the name can't reach other files.
+		if (!index.contains(name)) {
+			res.status = 404;
+			res.set_content("Image isn't in the index", "text/plain");
+			return;
+		}
+
+		sendImage(res, images, name);
+	});
+
+	server.Post("/neighbours", [&index, &batchPool, &searchCache](const httplib::Request &req, httplib::Response &res) {
+		std::vector<std::vector<Scalar>> descriptors;
+		SearchParams params;
+
+		try {
+			descriptors = parseDescriptors(req, index.getDescriptorSize());
+			params = parseSearchParams(req.params);
+			index.checkSearchParams(params);
+		} catch (const std::exception &e) {
+			res.status = 400;
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		std::vector<std::vector<SearchResult>> searchResults(descriptors.size());
+
+		runBatch(batchPool, descriptors.size(), [&](int i) {
+			searchResults[i] = searchCache.search(descriptors[i], params);
+		});
+
+		res.set_content(formatTextResults(searchResults), "text/plain");
+	});
 
-		std::string imagePath = dataset + '/' + searchResult.name;
-		std::ifstream file(imagePath, std::ios::binary | std::ios::ate);
+	server.Post("/insert", [&index, &journal, &batchPool, &images, &searchCache](const httplib::Request &req, httplib::Response &res) {
+		std::vector<std::string> names;
+		std::vector<std::vector<Scalar>> descriptors;
 
-		if (file.fail()) {
+		try {
+			parseItems(req.body, index.getDescriptorSize(), names, descriptors);
+		} catch (const std::exception &e) {
+			res.status = 400;
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		for (const std::string &name : names) {
+			images.erase(name);
+		}
+
+		try {
+			runBatch(batchPool, names.size(), [&](int i) {
+				journal.insert(std::move(names[i]), descriptors[i]);
+			});
+		} catch (const std::exception &e) {
+			searchCache.invalidate();
 			res.status = 500;
-			res.set_content("Can't find an image in the dataset", "text/plain");
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		searchCache.invalidate();
+		res.set_content(std::to_string(names.size()), "text/plain");
+	});
+
+	server.Post("/remove", [&journal, &images, &searchCache](const httplib::Request &req, httplib::Response &res) {
+		const char *begin = req.body.data();
+		const char *end = begin + req.body.size();
+		int count = 0;
+
+		try {
+			while (begin < end) {
+				const char *lineEnd = findLineEnd(begin, end);
+				const char *nameEnd = (lineEnd > begin && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+				std::string name(begin, nameEnd);
+
+				count += journal.remove(name);
+				images.erase(name);
+				begin = lineEnd + 1;
+			}
+		} catch (const std::exception &e) {
+			searchCache.invalidate();
+			res.status = 500;
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		searchCache.invalidate();
+		res.set_content(std::to_string(count), "text/plain");
+	});
+
+	server.Get("/search-cache", [&searchCache](const httplib::Request&, httplib::Response &res) {
+		SearchCacheStats stats = searchCache.getStats();
+		std::string content = "{\"hits\":" + std::to_string(stats.hits) + ",\"misses\":" + std::to_string(stats.misses) +
+			",\"entries\":" + std::to_string(stats.entries) + ",\"size\":" + std::to_string(stats.size) + "}";
+
+		res.set_content(content, "application/json");
+	});
+}
+
+// Writes the error to the response and returns false if no shard server responded.
+bool getShardsDescriptorSize(RemoteShards &shards, httplib::Response &res, int &descriptorSize) {
+	try {
+		descriptorSize = shards.getDescriptorSize();
+	} catch (const std::exception &e) {
+		res.status = 502;
+		res.set_content(e.what(), "text/plain");
+		return false;
+	}
+
+	return true;
+}
+
+// Writes the error to the response and returns false if the search failed. Partial results are marked with a header.
+bool searchShards(RemoteShards &shards, const std::string &body, const std::string &contentType, int count, const SearchParams &params, httplib::Response &res, RemoteSearch &search) {
+	try {
+		search = shards.search(body, contentType, count, params);
+	} catch (const std::invalid_argument &e) {
+		res.status = 400;
+		res.set_content(e.what(), "text/plain");
+		return false;
+	} catch (const std::exception &e) {
+		res.status = 502;
+		res.set_content(e.what(), "text/plain");
+		return false;
+	}
+
+	if (search.failedCount > 0) {
+		res.set_header("Failed-Shards", std::to_string(search.failedCount).c_str());
+	}
+
+	return true;
+}
+
+// Routes of the coordinator, queries are forwarded to shard servers and their results are merged.
+void setCoordinatorRoutes(httplib::Server &server, RemoteShards &shards) {
+	server.Get("/health", [](const httplib::Request&, httplib::Response &res) {
+		res.set_content("I'm OK", "text/plain");
+	});
+
+	server.Get("/descriptor-size", [&shards](const httplib::Request&, httplib::Response &res) {
+		int descriptorSize;
+
+		if (getShardsDescriptorSize(shards, res, descriptorSize)) {
+			res.set_content(std::to_string(descriptorSize), "text/plain");
+		}
+	});
+
+	server.Post("/neighbour", [&shards](const httplib::Request &req, httplib::Response &res) {
+		int descriptorSize;
+
+		if (!getShardsDescriptorSize(shards, res, descriptorSize)) {
+			return;
+		}
+
+		SearchParams params;
+		std::string body = req.body;
+		std::string bodyType = req.get_header_value("Content-Type");
+
+		std::string format = req.has_param("format") ? req.get_param_value("format") : "image";
+
+		try {
+			params = parseSearchParams(req.params);
+
+			if (format != "image" && format != "json" && format != "binary") {
+				throw std::runtime_error("Invalid format");
+			}
+
+			// Binary body is forwarded as is. Text body may span lines, shard servers read a line per query,
+			// so it's forwarded as a single line.
+			if (bodyType.find("application/octet-stream") == 0) {
+				parseBinaryDescriptor(req.body.data(), req.body.size(), descriptorSize);
+			} else {
+				FieldReader bodyReader(req.body.data(), req.body.data() + req.body.size());
+				body = formatDescriptor(parseDescriptor(bodyReader, descriptorSize));
+				bodyType = "text/plain";
+			}
+		} catch (const std::exception &e) {
+			res.status = 400;
+			res.set_content(e.what(), "text/plain");
 			return;
 		}
 
-		int size = file.tellg();
-		char *image = new char[size];
+		RemoteSearch search;
+
+		if (!searchShards(shards, body, bodyType, 1, params, res, search)) {
+			return;
+		}
 
-		file.seekg(0, std::ios::beg);
-		file.read(image, size);
+		const std::vector<SearchResult> &searchResults = search.results.front();
 
-		res.set_content(image, size, pickContentType(searchResult.name).c_str());
-		res.set_header("Name", searchResult.name.c_str());
+		if (format == "json") {
+			res.set_content(formatJsonResults(searchResults), "application/json");
+			return;
+		}
 
-		file.close();
-		delete[] image;
+		if (format == "binary") {
+			res.set_content(formatBinaryResults(searchResults), "application/octet-stream");
+			return;
+		}
+
+		if (searchResults.empty()) {
+			res.set_content("Index is empty", "text/plain");
+			return;
+		}
+
+		const std::string &name = searchResults.front().name;
+		std::string contentType;
+
+		try {
+			std::string image = shards.getImage(search.shards.front().front(), name, contentType);
+			res.set_content(image, contentType);
+		} catch (const std::exception &e) {
+			res.status = 502;
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		res.set_header("Name", name.c_str());
+	});
+
+	server.Post("/neighbours", [&shards](const httplib::Request &req, httplib::Response &res) {
+		int descriptorSize;
+
+		if (!getShardsDescriptorSize(shards, res, descriptorSize)) {
+			return;
+		}
+
+		std::vector<std::vector<Scalar>> descriptors;
+		SearchParams params;
+
+		try {
+			descriptors = parseDescriptors(req, descriptorSize);
+			params = parseSearchParams(req.params);
+		} catch (const std::exception &e) {
+			res.status = 400;
+			res.set_content(e.what(), "text/plain");
+			return;
+		}
+
+		if (descriptors.empty()) {
+			res.set_content("", "text/plain");
+			return;
+		}
+
+		RemoteSearch search;
+
+		std::string contentType = req.get_header_value("Content-Type");
+
+		if (searchShards(shards, req.body, contentType.empty() ? "text/plain" : contentType, descriptors.size(), params, res, search)) {
+			res.set_content(formatTextResults(search.results), "text/plain");
+		}
 	});
 }
 
+void listen(httplib::Server &server, const Arguments &args) {
+	std::cout << "Server is listening on " << args.address << ":" << args.port << std::endl;
+
+	if (!server.listen(args.address.c_str(), args.port)) {
+		throw std::runtime_error("Invalid address or port");
+	}
+}
+
 int main(int argc, char **argv) {
 	try {
 		Arguments args(argc, argv);
 
-		Index index = createIndex(args.indexSettings, args.dataPath, args.dumpPath, args.baseSize);
+		if (!args.convertPath.empty()) {
+			std::cout << "Converting dump..." << std::endl;
 
-		httplib::Server server;
-		setServerRoutes(server, index, args.dataset);
+			Index index(args.convertPath, args.indexSettings);
+			index.save(args.dumpPath);
+
+			return 0;
+		}
 
-		std::cout << "Server is listening on " << args.address << ":" << args.port << std::endl;
-		if (!server.listen(args.address.c_str(), args.port)) {
-			throw std::runtime_error("Invalid address or port");
+		if (!args.shardServers.empty()) {
+			std::cout << "Coordinating " << args.shardServers.size() << " shard servers..." << std::endl;
+
+			RemoteShards shards(args.shardServers, args.shardTimeout);
+			httplib::Server server;
+			setCoordinatorRoutes(server, shards);
+			listen(server, args);
+
+			return 0;
 		}
+
+		ShardedIndex index = createIndex(args.indexSettings, args.dataPath, args.dumpPath, args.baseSize, args.shardsCount);
+
+		std::cout << "Using " << Metric::kernel(index.getDescriptorSize()).name << " distance kernel" << std::endl;
+
+		Journal journal(index, args.dumpPath, args.syncInterval, args.snapshotInterval);
+
+		ThreadPool batchPool;
+		ImageCache images(args.dataset, static_cast<std::size_t>(args.imageCacheSize) << 20);
+		SearchCache searchCache(index, static_cast<std::size_t>(args.searchCacheSize) << 20, args.searchCacheStep);
+		httplib::Server server;
+		setServerRoutes(server, index, journal, batchPool, images, searchCache);
+		listen(server, args);
 	} catch (const std::exception &e) {
 		std::cout << e.what() << std::endl;
 		return -1;
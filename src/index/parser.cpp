@@ -0,0 +1,324 @@
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdio>
+#include <stdexcept>
+
+#include "parser.h"
+
+static const double powersOf10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static double powerOf10(int exponent) {
+	return exponent <= 22 ? powersOf10[exponent] : std::pow(10.0, exponent);
+}
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+const char* findLineEnd(const char *begin, const char *end) {
+	const char *lineEnd = static_cast<const char*>(memchr(begin, '\n', end - begin));
+	return lineEnd ? lineEnd : end;
+}
+
+const char* skipLines(const char *begin, const char *end, int count) {
+	for (int i = 0; i < count && begin < end; ++i) {
+		begin = findLineEnd(begin, end);
+
+		if (begin < end) {
+			++begin;
+		}
+	}
+
+	return begin;
+}
+
+std::vector<TextRange> splitLines(const char *begin, const char *end, int count) {
+	std::vector<TextRange> ranges;
+	std::size_t chunkSize = (end - begin) / count + 1;
+
+	while (begin < end) {
+		const char *chunkEnd = begin + std::min<std::size_t>(chunkSize, end - begin);
+
+		if (chunkEnd < end) {
+			chunkEnd = findLineEnd(chunkEnd, end);
+			chunkEnd = chunkEnd < end ? chunkEnd + 1 : end;
+		}
+
+		ranges.push_back({begin, chunkEnd});
+		begin = chunkEnd;
+	}
+
+	return ranges;
+}
+
+void forEachLine(ThreadPool &threadPool, const char *begin, const char *end, const LineAction &action) {
+	std::vector<TextRange> chunks = splitLines(begin, end, threadPool.getSize() * 4);
+
+	threadPool.parallelFor(chunks.size(), [&chunks, &action](int first, int last) {
+		for (int i = first; i < last; ++i) {
+			const char *line = chunks[i].begin;
+
+			while (line < chunks[i].end) {
+				const char *lineEnd = findLineEnd(line, chunks[i].end);
+
+				if (lineEnd > line && !(lineEnd - line == 1 && *line == '\r')) {
+					action(line, lineEnd);
+				}
+
+				line = lineEnd + 1;
+			}
+		}
+	}, 1);
+}
+
+bool parseInt(const char *&position, const char *end, int &value) {
+	const char *current = position;
+	bool negative = current < end && *current == '-';
+
+	if (current < end && (*current == '-' || *current == '+')) {
+		++current;
+	}
+
+	if (current == end || !isDigit(*current)) {
+		return false;
+	}
+
+	std::int64_t result = 0;
+
+	for (; current < end && isDigit(*current); ++current) {
+		result = result * 10 + (*current - '0');
+
+		if (result > std::numeric_limits<int>::max()) {
+			return false;
+		}
+	}
+
+	value = static_cast<int>(negative ? -result : result);
+	position = current;
+
+	return true;
+}
+
+// Keeps up to 19 significant digits. The result is correctly rounded, when they fit 2^53 (about 15 digits)
+// and the decimal exponent is within 22, otherwise it may be off by a few units in the last place,
+// which is far below the precision of float descriptors. Zero stays zero for any exponent.
+bool parseReal(const char *&position, const char *end, double &value) {
+	const char *current = position;
+	bool negative = current < end && *current == '-';
+
+	if (current < end && (*current == '-' || *current == '+')) {
+		++current;
+	}
+
+	std::uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool hasDigits = false;
+
+	for (; current < end && isDigit(*current); ++current) {
+		hasDigits = true;
+
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*current - '0');
+			digits += mantissa != 0;
+		} else {
+			++exponent;
+		}
+	}
+
+	if (current < end && *current == '.') {
+		++current;
+
+		for (; current < end && isDigit(*current); ++current) {
+			hasDigits = true;
+
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*current - '0');
+				digits += mantissa != 0;
+				--exponent;
+			}
+		}
+	}
+
+	if (!hasDigits) {
+		return false;
+	}
+
+	if (current < end && (*current == 'e' || *current == 'E')) {
+		++current;
+
+		bool negativeExponent = current < end && *current == '-';
+
+		if (current < end && (*current == '-' || *current == '+')) {
+			++current;
+		}
+
+		if (current == end || !isDigit(*current)) {
+			return false;
+		}
+
+		int explicitExponent = 0;
+
+		for (; current < end && isDigit(*current); ++current) {
+			if (explicitExponent < 100000) {
+				explicitExponent = explicitExponent * 10 + (*current - '0');
+			}
+		}
+
+		exponent += negativeExponent ? -explicitExponent : explicitExponent;
+	}
+
+	double result = static_cast<double>(mantissa);
+
+	if (mantissa == 0) {
+		// 0 * 10^400 would be 0 * inf = NaN.
+	} else if (exponent < 0) {
+		result /= powerOf10(-exponent);
+	} else if (exponent > 0) {
+		result *= powerOf10(exponent);
+	}
+
+	value = negative ? -result : result;
+	position = current;
+
+	return true;
+}
+
+void FieldReader::skipSpaces() {
+	while (position < end && (*position == ' ' || *position == '\t' || *position == '\r' || *position == '\n')) {
+		++position;
+	}
+}
+
+bool FieldReader::finishField() {
+	skipSpaces();
+
+	if (position == end) {
+		return true;
+	}
+
+	if (*position == ',') {
+		++position;
+		return true;
+	}
+
+	return false;
+}
+
+bool FieldReader::empty() {
+	skipSpaces();
+	return position == end;
+}
+
+bool FieldReader::readInt(int &value) {
+	skipSpaces();
+	return parseInt(position, end, value) && finishField();
+}
+
+bool FieldReader::readReal(double &value) {
+	skipSpaces();
+	return parseReal(position, end, value) && finishField();
+}
+
+bool FieldReader::readText(std::string &value) {
+	const char *fieldEnd = static_cast<const char*>(memchr(position, ',', end - position));
+	fieldEnd = fieldEnd ? fieldEnd : end;
+
+	value.assign(position, fieldEnd);
+	position = fieldEnd < end ? fieldEnd + 1 : end;
+
+	return true;
+}
+
+std::vector<Scalar> parseDescriptor(FieldReader &reader, int descriptorSize) {
+	std::vector<Scalar> descriptor(descriptorSize);
+	parseDescriptor(reader, descriptorSize, descriptor.data());
+
+	return descriptor;
+}
+
+void parseDescriptor(FieldReader &reader, int descriptorSize, Scalar *descriptor) {
+	double value;
+
+	for (int i = 0; i < descriptorSize; ++i) {
+		if (reader.empty()) {
+			throw std::runtime_error("Incorrect descriptor size");
+		}
+
+		if (!reader.readReal(value)) {
+			throw std::runtime_error("Invalid value");
+		}
+
+		if (!std::isfinite(value) || std::abs(value) > std::numeric_limits<Scalar>::max()) {
+			throw std::runtime_error("Value is out of range");
+		}
+
+		descriptor[i] = static_cast<Scalar>(value);
+	}
+
+	if (!reader.empty()) {
+		throw std::runtime_error("Incorrect descriptor size");
+	}
+}
+
+std::string formatDescriptor(const std::vector<Scalar> &descriptor) {
+	std::string result;
+	char value[32];
+
+	for (Scalar element : descriptor) {
+		std::snprintf(value, sizeof(value), ",%.*g", std::numeric_limits<Scalar>::max_digits10, static_cast<double>(element));
+		result += value;
+	}
+
+	return result.empty() ? result : result.substr(1);
+}
+
+int parseIntParam(const RequestParams &params, const std::string &name, int defaultValue, int minValue) {
+	RequestParams::const_iterator param = params.find(name);
+
+	if (param == params.end()) {
+		return defaultValue;
+	}
+
+	const std::string &value = param->second;
+	FieldReader reader(value.data(), value.data() + value.size());
+	int result;
+
+	if (!reader.readInt(result) || !reader.empty() || result < minValue) {
+		throw std::runtime_error("Invalid " + name);
+	}
+
+	return result;
+}
+
+SearchParams parseSearchParams(const RequestParams &params) {
+	SearchParams result;
+	result.k = parseIntParam(params, "k", 1, 1);
+	result.ef = parseIntParam(params, "ef", 0, 0);
+	result.maxEvaluations = parseIntParam(params, "maxEvaluations", 0, 0);
+
+	return result;
+}
+
+std::vector<Scalar> parseItem(const char *begin, const char *end, int descriptorSize, std::string &name) {
+	FieldReader reader(begin, end);
+	reader.readText(name);
+
+	return parseDescriptor(reader, descriptorSize);
+}
+
+void parseItem(const char *begin, const char *end, int descriptorSize, std::string &name, Scalar *descriptor) {
+	FieldReader reader(begin, end);
+	reader.readText(name);
+
+	parseDescriptor(reader, descriptorSize, descriptor);
+}
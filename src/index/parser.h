@@ -0,0 +1,76 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+#include "storage.h"
+#include "index.h"
+#include "thread_pool.h"
+
+struct TextRange {
+	const char *begin;
+	const char *end;
+};
+
+// Splits text into at most `count` ranges of whole lines.
+std::vector<TextRange> splitLines(const char *begin, const char *end, int count);
+
+// Returns position after `count` lines or `end` if there are less lines.
+const char* skipLines(const char *begin, const char *end, int count);
+
+const char* findLineEnd(const char *begin, const char *end);
+
+using LineAction = std::function<void(const char *begin, const char *end)>;
+
+// Runs action for every non-empty line on the pool. The first error is rethrown, lines of other chunks may be skipped after it.
+void forEachLine(ThreadPool &threadPool, const char *begin, const char *end, const LineAction &action);
+
+bool parseInt(const char *&position, const char *end, int &value);
+bool parseReal(const char *&position, const char *end, double &value);
+
+// Reads comma-separated fields in place, without allocations.
+class FieldReader {
+	const char *position;
+	const char *end;
+
+	void skipSpaces();
+	bool finishField();
+
+public:
+	FieldReader(const char *begin, const char *end) : position(begin), end(end) {}
+
+	bool empty();
+
+	bool readInt(int &value);
+	bool readReal(double &value);
+	bool readText(std::string &value);
+
+	const char* getPosition() const {
+		return position;
+	}
+};
+
+// Reads the rest of fields as descriptor values, throws with a message for the client on invalid values.
+std::vector<Scalar> parseDescriptor(FieldReader &reader, int descriptorSize);
+void parseDescriptor(FieldReader &reader, int descriptorSize, Scalar *descriptor);
+
+using RequestParams = std::multimap<std::string, std::string>;
+
+// Comma-separated descriptor values, which are parsed back to the same values.
+std::string formatDescriptor(const std::vector<Scalar> &descriptor);
+
+// Returns defaultValue for a missing parameter, throws "Invalid <name>" if the value isn't an integer or is below minValue.
+int parseIntParam(const RequestParams &params, const std::string &name, int defaultValue, int minValue);
+
+// Reads k, ef and maxEvaluations of a search request. 0 is accepted for ef and maxEvaluations, upper bounds are checked
+// by Index::checkSearchParams.
+SearchParams parseSearchParams(const RequestParams &params);
+
+// Item is a line of index data: name followed by descriptor values.
+std::vector<Scalar> parseItem(const char *begin, const char *end, int descriptorSize, std::string &name);
+void parseItem(const char *begin, const char *end, int descriptorSize, std::string &name, Scalar *descriptor);
+
+#endif
@@ -0,0 +1,354 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "remote_shards.h"
+#include "parser.h"
+
+struct RemoteShards::Response {
+	bool isReceived = false;
+	int status = 0;
+	std::string body;
+	std::string contentType;
+};
+
+// Responses of a send. Requests, that are late, finish in background, so they share it with the send.
+struct RemoteShards::Requests {
+	std::vector<Response> responses;
+	int pendingCount;
+	bool isAbandoned = false;
+
+	std::mutex mutex;
+	std::condition_variable doneCV;
+};
+
+class RemoteShards::Shard {
+	std::string host;
+	int port;
+	int timeout;
+
+	// Connections are kept alive between requests, a client is used by one request at a time.
+	std::vector<std::unique_ptr<httplib::Client>> idleClients;
+	std::mutex mutex;
+
+	std::atomic<int> descriptorSize{0};
+
+	std::unique_ptr<httplib::Client> takeClient();
+	void returnClient(std::unique_ptr<httplib::Client> client);
+	Response receive(std::unique_ptr<httplib::Client> client, httplib::Result result);
+
+public:
+	const std::string address;
+
+	Shard(std::string address, int timeout);
+
+	// Descriptor size of the shard server, it is requested until the server responds. 0 if it can't be reached.
+	int fetchDescriptorSize();
+
+	// 0 until the shard server responded with its descriptor size.
+	int getDescriptorSize() const {
+		return descriptorSize;
+	}
+
+	Response get(const std::string &path, const httplib::Params &params);
+	Response post(const std::string &path, const std::string &body, const std::string &contentType);
+};
+
+RemoteShards::Shard::Shard(std::string address, int timeout) : timeout(timeout), address(std::move(address)) {
+	std::size_t separator = this->address.rfind(':');
+
+	try {
+		if (separator == 0 || separator == std::string::npos) {
+			throw std::invalid_argument("no port");
+		}
+
+		std::size_t portEnd;
+		port = std::stoi(this->address.substr(separator + 1), &portEnd);
+
+		if (portEnd != this->address.size() - separator - 1 || port <= 0) {
+			throw std::invalid_argument("invalid port");
+		}
+	} catch (const std::exception&) {
+		throw std::runtime_error("Invalid shard server address " + this->address);
+	}
+
+	host = this->address.substr(0, separator);
+}
+
+std::unique_ptr<httplib::Client> RemoteShards::Shard::takeClient() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if (!idleClients.empty()) {
+		std::unique_ptr<httplib::Client> client = std::move(idleClients.back());
+		idleClients.pop_back();
+
+		return client;
+	}
+
+	lock.unlock();
+
+	std::unique_ptr<httplib::Client> client(new httplib::Client(host, port));
+
+	client->set_keep_alive(true);
+	client->set_connection_timeout(timeout / 1000, timeout % 1000 * 1000);
+	client->set_read_timeout(timeout / 1000, timeout % 1000 * 1000);
+	client->set_write_timeout(timeout / 1000, timeout % 1000 * 1000);
+
+	return client;
+}
+
+void RemoteShards::Shard::returnClient(std::unique_ptr<httplib::Client> client) {
+	std::unique_lock<std::mutex> lock(mutex);
+	idleClients.push_back(std::move(client));
+}
+
+RemoteShards::Response RemoteShards::Shard::receive(std::unique_ptr<httplib::Client> client, httplib::Result result) {
+	Response response;
+
+	// Connection of a failed request may be broken, so its client is dropped.
+	if (result) {
+		response.isReceived = true;
+		response.status = result->status;
+		response.body = std::move(result->body);
+		response.contentType = result->get_header_value("Content-Type");
+
+		returnClient(std::move(client));
+	}
+
+	return response;
+}
+
+int RemoteShards::Shard::fetchDescriptorSize() {
+	if (descriptorSize == 0) {
+		Response response = get("/descriptor-size", httplib::Params());
+		FieldReader reader(response.body.data(), response.body.data() + response.body.size());
+		int size;
+
+		if (response.status == 200 && reader.readInt(size) && reader.empty() && size > 0) {
+			descriptorSize = size;
+		}
+	}
+
+	return descriptorSize;
+}
+
+RemoteShards::Response RemoteShards::Shard::get(const std::string &path, const httplib::Params &params) {
+	std::unique_ptr<httplib::Client> client = takeClient();
+	httplib::Result result = client->Get(path, params, httplib::Headers());
+
+	return receive(std::move(client), std::move(result));
+}
+
+RemoteShards::Response RemoteShards::Shard::post(const std::string &path, const std::string &body, const std::string &contentType) {
+	std::unique_ptr<httplib::Client> client = takeClient();
+	httplib::Result result = client->Post(path, body, contentType);
+
+	return receive(std::move(client), std::move(result));
+}
+
+// Parses a /neighbours response: line per query with comma-separated pairs of name and distance.
+static bool parseNeighbours(const std::string &body, int count, std::vector<std::vector<SearchResult>> &results) {
+	const char *begin = body.data();
+	const char *end = begin + body.size();
+
+	results.resize(count);
+
+	for (int query = 0; query < count; ++query) {
+		if (begin >= end) {
+			return false;
+		}
+
+		const char *lineEnd = findLineEnd(begin, end);
+		FieldReader reader(begin, lineEnd);
+		std::string name;
+		double distance;
+
+		while (reader.getPosition() < lineEnd) {
+			if (!reader.readText(name) || !reader.readReal(distance)) {
+				return false;
+			}
+
+			results[query].emplace_back(std::move(name), distance);
+		}
+
+		begin = lineEnd + 1;
+	}
+
+	return begin >= end;
+}
+
+RemoteShards::RemoteShards(const std::vector<std::string> &addresses, int timeout) : timeout(timeout) {
+	for (const std::string &address : addresses) {
+		shardIds.push_back(shards.size());
+		shards.emplace_back(new Shard(address, timeout));
+	}
+
+	if (shards.empty()) {
+		throw std::runtime_error("No shard servers");
+	}
+}
+
+RemoteShards::~RemoteShards() {}
+
+// Thread per request lets the send return at the timeout, while a late shard server still holds its thread.
+// Timeouts of the client end such threads after a while.
+std::vector<RemoteShards::Response> RemoteShards::send(const std::vector<int> &ids, const ShardRequest &request) {
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	std::shared_ptr<Requests> requests = std::make_shared<Requests>();
+
+	requests->responses.resize(ids.size());
+	requests->pendingCount = ids.size();
+
+	for (int i = 0; i < ids.size(); ++i) {
+		std::shared_ptr<Shard> shard = shards[ids[i]];
+
+		std::thread([requests, shard, request, i]() {
+			Response response = request(*shard);
+
+			std::unique_lock<std::mutex> lock(requests->mutex);
+
+			if (!requests->isAbandoned) {
+				requests->responses[i] = std::move(response);
+			}
+
+			--requests->pendingCount;
+			requests->doneCV.notify_all();
+		}).detach();
+	}
+
+	std::unique_lock<std::mutex> lock(requests->mutex);
+
+	requests->doneCV.wait_until(lock, deadline, [&requests]() {
+		return requests->pendingCount == 0;
+	});
+
+	requests->isAbandoned = true;
+
+	return std::move(requests->responses);
+}
+
+int RemoteShards::getDescriptorSize() {
+	if (descriptorSize == 0) {
+		send(shardIds, [](Shard &shard) {
+			Response response;
+			response.isReceived = shard.fetchDescriptorSize() > 0;
+
+			return response;
+		});
+
+		for (std::shared_ptr<Shard> &shard : shards) {
+			int size = shard->getDescriptorSize();
+			int unknown = 0;
+
+			if (size > 0) {
+				descriptorSize.compare_exchange_strong(unknown, size);
+				break;
+			}
+		}
+
+		if (descriptorSize == 0) {
+			throw std::runtime_error("No shard server responded");
+		}
+	}
+
+	return descriptorSize;
+}
+
+RemoteSearch RemoteShards::search(const std::string &body, const std::string &contentType, int count, const SearchParams &params) {
+	std::string path = "/neighbours?k=" + std::to_string(params.k);
+
+	if (params.ef > 0) {
+		path += "&ef=" + std::to_string(params.ef);
+	}
+
+	if (params.maxEvaluations > 0) {
+		path += "&maxEvaluations=" + std::to_string(params.maxEvaluations);
+	}
+
+	int size = getDescriptorSize();
+	std::shared_ptr<const std::string> sharedBody = std::make_shared<std::string>(body);
+
+	std::vector<Response> responses = send(shardIds, [sharedBody, path, contentType, size](Shard &shard) {
+		return shard.fetchDescriptorSize() == size ? shard.post(path, *sharedBody, contentType) : Response();
+	});
+
+	std::vector<std::vector<std::vector<SearchResult>>> shardResults(shards.size());
+	std::vector<char> isResponded(shards.size(), false);
+	std::vector<std::string> rejections(shards.size());
+
+	for (int shard = 0; shard < shards.size(); ++shard) {
+		const Response &response = responses[shard];
+
+		if (response.isReceived && response.status == 400) {
+			rejections[shard] = response.body;
+		} else if (response.isReceived && response.status == 200) {
+			isResponded[shard] = parseNeighbours(response.body, count, shardResults[shard]);
+		}
+	}
+
+	// All shard servers check queries the same way, so a rejection holds for the whole query.
+	for (const std::string &rejection : rejections) {
+		if (!rejection.empty()) {
+			throw std::invalid_argument(rejection);
+		}
+	}
+
+	RemoteSearch search;
+	search.failedCount = std::count(isResponded.begin(), isResponded.end(), false);
+
+	if (search.failedCount == shards.size()) {
+		throw std::runtime_error("No shard server responded");
+	}
+
+	search.results.resize(count);
+	search.shards.resize(count);
+
+	for (int query = 0; query < count; ++query) {
+		std::vector<std::pair<const SearchResult*, int>> candidates;
+
+		for (int shard = 0; shard < shards.size(); ++shard) {
+			if (isResponded[shard]) {
+				for (const SearchResult &result : shardResults[shard][query]) {
+					candidates.emplace_back(&result, shard);
+				}
+			}
+		}
+
+		// Every shard server returns its own top k, the overall top k is among them.
+		auto candidatesEnd = candidates.begin() + std::min<std::size_t>(params.k, candidates.size());
+
+		std::partial_sort(candidates.begin(), candidatesEnd, candidates.end(),
+			[](const std::pair<const SearchResult*, int> &a, const std::pair<const SearchResult*, int> &b) {
+				return a.first->distance < b.first->distance;
+			});
+
+		for (auto candidate = candidates.begin(); candidate != candidatesEnd; ++candidate) {
+			search.results[query].push_back(*candidate->first);
+			search.shards[query].push_back(candidate->second);
+		}
+	}
+
+	return search;
+}
+
+std::string RemoteShards::getImage(int shard, const std::string &name, std::string &contentType) {
+	std::vector<Response> responses = send(std::vector<int>{shard}, [name](Shard &shard) {
+		return shard.get("/image", httplib::Params{{"name", name}});
+	});
+
+	Response &response = responses.front();
+
+	if (!response.isReceived || response.status != 200) {
+		throw std::runtime_error("Can't fetch image " + name + " from shard server " + shards[shard]->address);
+	}
+
+	contentType = response.contentType;
+
+	return std::move(response.body);
+}
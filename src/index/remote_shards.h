@@ -0,0 +1,66 @@
+#ifndef REMOTE_SHARDS_H
+#define REMOTE_SHARDS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+
+#include "index.h"
+#include "httplib.h"
+
+// Merged results of a search on shard servers.
+struct RemoteSearch {
+	// Top k of each query.
+	std::vector<std::vector<SearchResult>> results;
+	// Shard server, that returned each result.
+	std::vector<std::vector<int>> shards;
+	// Shard servers, that failed or didn't respond in time. Their images are missing from the results.
+	int failedCount = 0;
+};
+
+// Index servers holding parts of the images, queried by the coordinator over keep-alive connections.
+// Shard servers are connected on the first request, so the coordinator starts while some of them are down.
+class RemoteShards {
+	class Shard;
+	struct Response;
+	struct Requests;
+
+	using ShardRequest = std::function<Response(Shard &shard)>;
+
+	std::vector<std::shared_ptr<Shard>> shards;
+	std::vector<int> shardIds;
+	int timeout;
+	std::atomic<int> descriptorSize{0};
+
+	// Sends the request to the shard servers in parallel and waits for them until the timeout ends.
+	// Responses of shard servers, that failed or didn't respond in time, aren't received.
+	std::vector<Response> send(const std::vector<int> &ids, const ShardRequest &request);
+
+public:
+	// Addresses are host:port, timeout is in milliseconds and limits whole requests to shard servers.
+	RemoteShards(const std::vector<std::string> &addresses, int timeout);
+	~RemoteShards();
+
+	RemoteShards(const RemoteShards&) = delete;
+	RemoteShards& operator=(const RemoteShards&) = delete;
+
+	int getShardsCount() const {
+		return shards.size();
+	}
+
+	// Descriptor size of the first shard server, that responds. Throws if none of them responds.
+	int getDescriptorSize();
+
+	// Sends `count` descriptors of the body, a line or a binary row per descriptor, to /neighbours of every
+	// shard server in parallel. Shard servers with another descriptor size are counted as failed.
+	// Throws std::invalid_argument with the message of a shard server, that rejected the query,
+	// and std::runtime_error if no shard server responded.
+	RemoteSearch search(const std::string &body, const std::string &contentType, int count, const SearchParams &params);
+
+	// Fetches the image from its shard server, throws if it can't be fetched.
+	std::string getImage(int shard, const std::string &name, std::string &contentType);
+};
+
+#endif
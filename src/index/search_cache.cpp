@@ -0,0 +1,198 @@
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstdint>
+
+#include "search_cache.h"
+
+struct SearchCache::Key {
+	std::vector<std::int32_t> values;
+	SearchParams params;
+	std::size_t hash;
+
+	bool operator==(const Key &other) const {
+		return hash == other.hash && values == other.values && params.k == other.params.k &&
+			params.ef == other.params.ef && params.maxEvaluations == other.params.maxEvaluations &&
+			params.withDescriptors == other.params.withDescriptors;
+	}
+};
+
+struct SearchCache::KeyHash {
+	std::size_t operator()(const Key *key) const {
+		return key->hash;
+	}
+};
+
+struct SearchCache::KeyEqual {
+	bool operator()(const Key *a, const Key *b) const {
+		return *a == *b;
+	}
+};
+
+struct SearchCache::Entry {
+	Key key;
+	std::vector<SearchResult> results;
+	std::uint64_t epoch;
+	std::size_t size;
+};
+
+class SearchCache::Shard {
+	std::size_t capacity;
+	std::size_t size = 0;
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+
+	// Most recently used first, positions are keyed by keys of the entries.
+	std::list<Entry> entries;
+	std::unordered_map<const Key*, std::list<Entry>::iterator, KeyHash, KeyEqual> positions;
+	std::mutex mutex;
+
+	void evict(std::list<Entry>::iterator entry) {
+		size -= entry->size;
+		positions.erase(&entry->key);
+		entries.erase(entry);
+	}
+
+public:
+	explicit Shard(std::size_t capacity) : capacity(capacity) {}
+
+	bool find(const Key &key, std::uint64_t epoch, std::vector<SearchResult> &results) {
+		std::unique_lock<std::mutex> lock(mutex);
+		auto position = positions.find(&key);
+
+		if (position == positions.end() || position->second->epoch != epoch) {
+			if (position != positions.end()) {
+				evict(position->second);
+			}
+
+			++misses;
+			return false;
+		}
+
+		entries.splice(entries.begin(), entries, position->second);
+		results = position->second->results;
+		++hits;
+
+		return true;
+	}
+
+	void insert(Key key, std::vector<SearchResult> results, std::uint64_t epoch) {
+		std::size_t entrySize = sizeof(Entry) + 4 * sizeof(void*) + key.values.size() * sizeof(std::int32_t) +
+			results.size() * sizeof(SearchResult);
+
+		for (const SearchResult &result : results) {
+			entrySize += result.name.size() + result.descriptor.size() * sizeof(Scalar);
+		}
+
+		if (entrySize > capacity) {
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		auto position = positions.find(&key);
+
+		if (position != positions.end()) {
+			evict(position->second);
+		}
+
+		entries.push_front({std::move(key), std::move(results), epoch, entrySize});
+		positions.emplace(&entries.front().key, entries.begin());
+		size += entrySize;
+
+		while (size > capacity) {
+			evict(std::prev(entries.end()));
+		}
+	}
+
+	void addStats(SearchCacheStats &stats) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		stats.hits += hits;
+		stats.misses += misses;
+		stats.entries += entries.size();
+		stats.size += size;
+	}
+};
+
+SearchCache::SearchCache(ShardedIndex &index, std::size_t capacity, double step) : index(index), step(step) {
+	if (capacity > 0) {
+		for (std::unique_ptr<Shard> &shard : shards) {
+			shard.reset(new Shard(capacity / shardsCount));
+		}
+	}
+}
+
+SearchCache::~SearchCache() = default;
+
+SearchCache::Key SearchCache::makeKey(const std::vector<Scalar> &descriptor, const SearchParams &params) {
+	Key key;
+	key.values.reserve(descriptor.size());
+	key.params = params;
+
+	// FNV-1a over quantized values and parameters.
+	std::uint64_t hash = 14695981039346656037ull;
+
+	auto mix = [&hash](std::int32_t value) {
+		hash = (hash ^ static_cast<std::uint32_t>(value)) * 1099511628211ull;
+	};
+
+	for (Scalar value : descriptor) {
+		double level = std::floor(value / step + 0.5);
+		level = std::min<double>(std::max<double>(level, std::numeric_limits<std::int32_t>::min()), std::numeric_limits<std::int32_t>::max());
+
+		key.values.push_back(static_cast<std::int32_t>(level));
+		mix(key.values.back());
+	}
+
+	mix(params.k);
+	mix(params.ef);
+	mix(params.maxEvaluations);
+	mix(params.withDescriptors);
+
+	key.hash = static_cast<std::size_t>(hash ^ (hash >> 32));
+
+	return key;
+}
+
+std::vector<SearchResult> SearchCache::search(const std::vector<Scalar> &descriptor, const SearchParams &params) {
+	if (!shards[0]) {
+		return index.search(descriptor, params);
+	}
+
+	Key key = makeKey(descriptor, params);
+	Shard &shard = *shards[(key.hash >> 8) % shardsCount];
+
+	std::uint64_t searchEpoch = epoch.load();
+	std::vector<SearchResult> results;
+
+	if (shard.find(key, searchEpoch, results)) {
+		return results;
+	}
+
+	results = index.search(descriptor, params);
+	shard.insert(std::move(key), results, searchEpoch);
+
+	return results;
+}
+
+void SearchCache::invalidate() {
+	++epoch;
+}
+
+SearchCacheStats SearchCache::getStats() {
+	SearchCacheStats stats;
+
+	if (shards[0]) {
+		for (std::unique_ptr<Shard> &shard : shards) {
+			shard->addStats(stats);
+		}
+	}
+
+	return stats;
+}
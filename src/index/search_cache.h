@@ -0,0 +1,60 @@
+#ifndef SEARCH_CACHE_H
+#define SEARCH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "sharded_index.h"
+
+struct SearchCacheStats {
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::size_t entries = 0;
+	std::size_t size = 0;
+};
+
+// LRU cache of search results in front of the index. Descriptors are quantized for the key,
+// so repeated and nearly identical queries share results. Sharded by key hash to keep lock contention low.
+class SearchCache {
+	struct Key;
+	struct KeyHash;
+	struct KeyEqual;
+	struct Entry;
+	class Shard;
+
+	static const int shardsCount = 16;
+
+	ShardedIndex &index;
+	double step;
+
+	// Results are cached with the epoch their search started in, entries of older epochs are stale.
+	std::atomic<std::uint64_t> epoch{0};
+
+	std::unique_ptr<Shard> shards[shardsCount];
+
+	Key makeKey(const std::vector<Scalar> &descriptor, const SearchParams &params);
+
+public:
+	// capacity = 0 disables caching. Descriptor values closer than step share a key.
+	SearchCache(ShardedIndex &index, std::size_t capacity, double step);
+	~SearchCache();
+
+	SearchCache(const SearchCache&) = delete;
+	SearchCache& operator=(const SearchCache&) = delete;
+
+	std::vector<SearchResult> search(const std::vector<Scalar> &descriptor, const SearchParams &params);
+
+	// Drops all results, called after the index changes.
+	void invalidate();
+
+	SearchCacheStats getStats();
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <cstdint>
+
+#include "sharded_index.h"
+
+ShardedIndex::ShardedIndex(int descriptorSize, int shardsCount, Settings settings) {
+	for (int shard = 0; shard < shardsCount; ++shard) {
+		shards.emplace_back(new Index(descriptorSize, settings));
+	}
+
+	initSearchPool();
+}
+
+ShardedIndex::ShardedIndex(const std::string &dumpPath, int shardsCount, Settings settings) {
+	hasDump(dumpPath, shardsCount);
+
+	for (int shard = 0; shard < shardsCount; ++shard) {
+		shards.emplace_back(new Index(getDumpPath(dumpPath, shard, shardsCount), settings));
+
+		if (shards.back()->getDescriptorSize() != shards.front()->getDescriptorSize()) {
+			throw std::runtime_error("Shards of dump " + dumpPath + " have different descriptor sizes");
+		}
+	}
+
+	initSearchPool();
+}
+
+void ShardedIndex::initSearchPool() {
+	if (shards.size() > 1) {
+		searchPool.reset(new ThreadPool(shards.size()));
+	}
+}
+
+std::string ShardedIndex::getDumpPath(const std::string &dumpPath, int shard, int shardsCount) {
+	return shardsCount > 1 ? dumpPath + ".shard" + std::to_string(shard) : dumpPath;
+}
+
+static bool fileExists(const std::string &path) {
+	return std::ifstream(path).good();
+}
+
+// Names are assigned to shards by the count, so with another count they would be searched and removed in wrong shards.
+bool ShardedIndex::hasDump(const std::string &dumpPath, int shardsCount) {
+	std::string count = std::to_string(shardsCount);
+
+	if (shardsCount > 1 && fileExists(dumpPath)) {
+		throw std::runtime_error("Dump " + dumpPath + " was created without shards, not with " + count);
+	}
+
+	if (shardsCount == 1 && fileExists(getDumpPath(dumpPath, 0, 2))) {
+		throw std::runtime_error("Dump " + dumpPath + " was created with shards, not without them");
+	}
+
+	if (shardsCount > 1 && fileExists(getDumpPath(dumpPath, shardsCount, shardsCount))) {
+		throw std::runtime_error("Dump " + dumpPath + " has more shards than " + count);
+	}
+
+	int existingCount = 0;
+
+	for (int shard = 0; shard < shardsCount; ++shard) {
+		existingCount += fileExists(getDumpPath(dumpPath, shard, shardsCount));
+	}
+
+	if (existingCount > 0 && existingCount < shardsCount) {
+		throw std::runtime_error("Dump " + dumpPath + " has fewer shards than " + count);
+	}
+
+	return existingCount == shardsCount;
+}
+
+// FNV-1a, names have to stay in their shards across restarts and platforms.
+int ShardedIndex::getShard(const std::string &name) const {
+	std::uint32_t hash = 2166136261u;
+
+	for (char c : name) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+	}
+
+	return hash % shards.size();
+}
+
+int ShardedIndex::getSize() {
+	int size = 0;
+
+	for (std::unique_ptr<Index> &shard : shards) {
+		size += shard->getSize();
+	}
+
+	return size;
+}
+
+std::uint32_t ShardedIndex::getLogGeneration() {
+	std::uint32_t generation = shards.front()->getLogGeneration();
+
+	for (std::unique_ptr<Index> &shard : shards) {
+		generation = std::min(generation, shard->getLogGeneration());
+	}
+
+	return generation;
+}
+
+std::uint32_t ShardedIndex::getLogGeneration(int shard) {
+	return shards[shard]->getLogGeneration();
+}
+
+void ShardedIndex::insert(std::string name, const std::vector<Scalar> &descriptor) {
+	insert(std::move(name), descriptor.data());
+}
+
+void ShardedIndex::insert(std::string name, const Scalar *descriptor) {
+	Index &shard = *shards[getShard(name)];
+	shard.insert(std::move(name), descriptor);
+}
+
+int ShardedIndex::remove(const std::string &name) {
+	return shards[getShard(name)]->remove(name);
+}
+
+bool ShardedIndex::contains(const std::string &name) {
+	return shards[getShard(name)]->contains(name);
+}
+
+int ShardedIndex::repair() {
+	int changedCount = 0;
+
+	for (std::unique_ptr<Index> &shard : shards) {
+		changedCount += shard->repair();
+	}
+
+	return changedCount;
+}
+
+void ShardedIndex::checkSearchParams(const SearchParams &params) {
+	shards.front()->checkSearchParams(params);
+}
+
+std::vector<SearchResult> ShardedIndex::search(const std::vector<Scalar> &descriptor, const SearchParams &params) {
+	if (shards.size() == 1) {
+		return shards.front()->search(descriptor, params);
+	}
+
+	std::vector<std::vector<SearchResult>> shardResults(shards.size());
+
+	searchPool->parallelFor(shards.size(), [&](int begin, int end) {
+		for (int shard = begin; shard < end; ++shard) {
+			shardResults[shard] = shards[shard]->search(descriptor, params);
+		}
+	}, 1);
+
+	std::vector<SearchResult> results;
+
+	for (std::vector<SearchResult> &shardResult : shardResults) {
+		std::move(shardResult.begin(), shardResult.end(), std::back_inserter(results));
+	}
+
+	// Every shard returns its own top k, the overall top k is among them.
+	auto resultsEnd = results.begin() + std::min<std::size_t>(params.k, results.size());
+
+	std::partial_sort(results.begin(), resultsEnd, results.end(), [](const SearchResult &a, const SearchResult &b) {
+		return a.distance < b.distance;
+	});
+
+	results.erase(resultsEnd, results.end());
+
+	return results;
+}
+
+ShardedIndex::Snapshot ShardedIndex::snapshot(std::uint32_t generation) {
+	Snapshot snapshot;
+
+	for (std::unique_ptr<Index> &shard : shards) {
+		snapshot.shards.push_back(shard->snapshot(generation));
+	}
+
+	return snapshot;
+}
+
+void ShardedIndex::save(const std::string &dumpPath) {
+	for (int shard = 0; shard < shards.size(); ++shard) {
+		shards[shard]->save(getDumpPath(dumpPath, shard, shards.size()));
+	}
+}
+
+void ShardedIndex::save(const std::string &dumpPath, const Snapshot &snapshot) {
+	for (int shard = 0; shard < shards.size(); ++shard) {
+		shards[shard]->save(getDumpPath(dumpPath, shard, shards.size()), snapshot.shards[shard]);
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef SHARDED_INDEX_H
+#define SHARDED_INDEX_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "index.h"
+#include "thread_pool.h"
+
+// Images partitioned across independent indexes by name hash. Shards have their own graphs, entry points and dumps,
+// so inserts into different shards don't contend. Searches run on all shards in parallel and merge their results.
+class ShardedIndex {
+	std::vector<std::unique_ptr<Index>> shards;
+	std::unique_ptr<ThreadPool> searchPool;
+
+	void initSearchPool();
+
+public:
+	class Snapshot;
+
+	ShardedIndex(int descriptorSize, int shardsCount, Settings settings = Settings());
+
+	// Loads the dump of every shard, the count has to match the one the dumps were created with.
+	ShardedIndex(const std::string &dumpPath, int shardsCount, Settings settings = Settings());
+
+	// Dump of a single shard lies at dumpPath, dumps of multiple shards get a shard suffix.
+	static std::string getDumpPath(const std::string &dumpPath, int shard, int shardsCount);
+
+	// Returns, if dumps of all shards exist. Throws, if dumps were created with another count of shards.
+	static bool hasDump(const std::string &dumpPath, int shardsCount);
+
+	int getShardsCount() const {
+		return shards.size();
+	}
+
+	// Shard of the images with the name.
+	int getShard(const std::string &name) const;
+
+	int getDescriptorSize() {
+		return shards.front()->getDescriptorSize();
+	}
+
+	int getSize();
+
+	// Logs older than the generation are folded into dumps of all shards.
+	std::uint32_t getLogGeneration();
+
+	// Logs older than the generation are folded into the dump of the shard.
+	std::uint32_t getLogGeneration(int shard);
+
+	void insert(std::string name, const std::vector<Scalar> &descriptor);
+	void insert(std::string name, const Scalar *descriptor);
+
+	int remove(const std::string &name);
+	bool contains(const std::string &name);
+	int repair();
+
+	void checkSearchParams(const SearchParams &params);
+	std::vector<SearchResult> search(const std::vector<Scalar> &descriptor, const SearchParams &params = SearchParams());
+
+	Snapshot snapshot(std::uint32_t generation);
+
+	void save(const std::string &dumpPath);
+	void save(const std::string &dumpPath, const Snapshot &snapshot);
+};
+
+class ShardedIndex::Snapshot {
+	friend class ShardedIndex;
+
+	std::vector<Index::Snapshot> shards;
+};
+
+#endif
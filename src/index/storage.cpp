@@ -0,0 +1,222 @@
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "storage.h"
+
+void* alignedAlloc(std::size_t size, std::size_t alignment) {
+	void *pointer = nullptr;
+
+#ifdef _MSC_VER
+	pointer = _aligned_malloc(size, alignment);
+#else
+	if (posix_memalign(&pointer, alignment, size) != 0) {
+		pointer = nullptr;
+	}
+#endif
+
+	if (!pointer) {
+		throw std::bad_alloc();
+	}
+
+	return pointer;
+}
+
+void alignedFree(void *pointer) {
+#ifdef _MSC_VER
+	_aligned_free(pointer);
+#else
+	free(pointer);
+#endif
+}
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path) {
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Can't open " + path);
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	size = static_cast<std::size_t>(fileSize.QuadPart);
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	data = mapping ? static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0)) : nullptr;
+
+	if (!data) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+
+		CloseHandle(file);
+		throw std::runtime_error("Can't map " + path);
+	}
+}
+
+MappedFile::~MappedFile() {
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const std::string &path) {
+	int file = open(path.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		throw std::runtime_error("Can't open " + path);
+	}
+
+	struct stat fileStat;
+
+	if (fstat(file, &fileStat) != 0) {
+		close(file);
+		throw std::runtime_error("Can't read " + path);
+	}
+
+	size = fileStat.st_size;
+	void *pointer = size > 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	close(file);
+
+	if (pointer == MAP_FAILED) {
+		throw std::runtime_error("Can't map " + path);
+	}
+
+	data = static_cast<char*>(pointer);
+}
+
+MappedFile::~MappedFile() {
+	munmap(data, size);
+}
+#endif
+
+#ifdef _WIN32
+AppendFile::AppendFile(const std::string &path) {
+	file = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+
+	if (file < 0) {
+		throw std::runtime_error("Can't open " + path);
+	}
+}
+
+AppendFile::~AppendFile() {
+	_close(file);
+}
+
+bool AppendFile::write(const char *data, std::size_t size) {
+	while (size > 0) {
+		int written = _write(file, data, static_cast<unsigned>(std::min<std::size_t>(size, 1 << 30)));
+
+		if (written <= 0) {
+			return false;
+		}
+
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool AppendFile::sync() {
+	return _commit(file) == 0;
+}
+
+bool syncFile(const std::string &path) {
+	int file = _open(path.c_str(), _O_RDWR | _O_BINARY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	bool isSynced = _commit(file) == 0;
+	_close(file);
+
+	return isSynced;
+}
+
+bool replaceFile(const std::string &from, const std::string &to) {
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+#else
+AppendFile::AppendFile(const std::string &path) {
+	file = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+	if (file < 0) {
+		throw std::runtime_error("Can't open " + path);
+	}
+}
+
+AppendFile::~AppendFile() {
+	close(file);
+}
+
+bool AppendFile::write(const char *data, std::size_t size) {
+	while (size > 0) {
+		ssize_t written = ::write(file, data, size);
+
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (written <= 0) {
+			return false;
+		}
+
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool AppendFile::sync() {
+	return fsync(file) == 0;
+}
+
+bool syncFile(const std::string &path) {
+	int file = open(path.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	bool isSynced = fsync(file) == 0;
+	close(file);
+
+	return isSynced;
+}
+
+bool replaceFile(const std::string &from, const std::string &to) {
+	if (rename(from.c_str(), to.c_str()) != 0) {
+		return false;
+	}
+
+	std::string::size_type separator = to.find_last_of('/');
+	std::string directory = separator == std::string::npos ? "." : to.substr(0, separator + 1);
+
+	return syncFile(directory);
+}
+#endif
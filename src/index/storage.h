@@ -0,0 +1,324 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <cstddef>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef INDEX_DOUBLE_PRECISION
+using Scalar = double;
+#else
+using Scalar = float;
+#endif
+
+const std::size_t cacheLineSize = 64;
+
+void* alignedAlloc(std::size_t size, std::size_t alignment);
+void alignedFree(void *pointer);
+
+inline int floorLog2(std::size_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+// Starts loading cache lines of [address, address + size) without waiting for them.
+inline void prefetch(const void *address, std::size_t size = cacheLineSize) {
+	const char *line = static_cast<const char*>(address);
+
+	for (std::size_t offset = 0; offset < size; offset += cacheLineSize) {
+#ifdef _MSC_VER
+		_mm_prefetch(line + offset, _MM_HINT_T0);
+#else
+		__builtin_prefetch(line + offset);
+#endif
+	}
+}
+
+// Read-only file mapped copy-on-write: pages may be modified in memory without touching the file.
+class MappedFile {
+	char *data = nullptr;
+	std::size_t size = 0;
+
+#ifdef _WIN32
+	void *file = nullptr;
+	void *mapping = nullptr;
+#endif
+
+public:
+	explicit MappedFile(const std::string &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	char* getData() const {
+		return data;
+	}
+
+	std::size_t getSize() const {
+		return size;
+	}
+};
+
+// File opened for appending. Written data is durable only after sync.
+class AppendFile {
+	int file = -1;
+
+public:
+	explicit AppendFile(const std::string &path);
+	~AppendFile();
+
+	AppendFile(const AppendFile&) = delete;
+	AppendFile& operator=(const AppendFile&) = delete;
+
+	bool write(const char *data, std::size_t size);
+	bool sync();
+};
+
+// Flushes file contents to the disk.
+bool syncFile(const std::string &path);
+
+// Atomically replaces file at path `to` with file at path `from`.
+bool replaceFile(const std::string &from, const std::string &to);
+
+// Id-indexed table of fixed-width rows.
+// Rows of the first `capacity` ids live in one contiguous slab, further ids go to geometrically growing slabs,
+// so rows never move and may be read while other threads append new ones.
+template<class T>
+class RowStore {
+	static const int maxSegments = 32;
+	static const std::size_t minSegmentRows = 1024;
+
+	int width = 0;
+	std::size_t stride = 0;
+
+	T *prefix = nullptr;
+	std::size_t prefixRows = 0;
+	bool ownsPrefix = true;
+
+	int segmentShift = 0;
+	std::atomic<T*> segments[maxSegments];
+
+	std::mutex growMutex;
+
+	T* allocateRows(std::size_t rows);
+	void freeRows(T *data, std::size_t rows);
+
+	void grow(int segment);
+	void release();
+
+	void move(RowStore &&other);
+
+	void locate(std::size_t id, int &segment, std::size_t &offset) const {
+		std::size_t position = id - prefixRows + (std::size_t(1) << segmentShift);
+		segment = floorLog2(position >> segmentShift);
+		offset = position - (std::size_t(1) << (segmentShift + segment));
+	}
+
+public:
+	RowStore() : RowStore(0) {}
+	RowStore(int width, std::size_t capacity = 0, std::size_t rowAlignment = sizeof(T));
+
+	// Serves the first `rows` ids from memory owned by the caller, e.g. a mapped dump.
+	RowStore(int width, T *rows, std::size_t count, std::size_t rowAlignment = sizeof(T));
+
+	RowStore(const RowStore&) = delete;
+	RowStore& operator=(const RowStore&) = delete;
+
+	RowStore(RowStore &&other);
+	RowStore& operator=(RowStore &&other);
+
+	~RowStore();
+
+	int getWidth() const {
+		return width;
+	}
+
+	std::size_t getStride() const {
+		return stride;
+	}
+
+	T* row(std::size_t id) const {
+		if (id < prefixRows) {
+			return prefix + id * stride;
+		}
+
+		int segment;
+		std::size_t offset;
+		locate(id, segment, offset);
+
+		return segments[segment].load(std::memory_order_acquire) + offset * stride;
+	}
+
+	// Returns null for rows of segments that aren't allocated yet.
+	T* find(std::size_t id) const {
+		if (id < prefixRows) {
+			return prefix + id * stride;
+		}
+
+		int segment;
+		std::size_t offset;
+		locate(id, segment, offset);
+
+		T *rows = segments[segment].load(std::memory_order_acquire);
+		return rows ? rows + offset * stride : nullptr;
+	}
+
+	T* allocate(std::size_t id);
+};
+
+// std::max takes the bound by reference, so it needs a definition.
+template<class T>
+const std::size_t RowStore<T>::minSegmentRows;
+
+template<class T>
+RowStore<T>::RowStore(int width, std::size_t capacity, std::size_t rowAlignment) : width(width) {
+	std::size_t rowBytes = (width * sizeof(T) + rowAlignment - 1) / rowAlignment * rowAlignment;
+	stride = rowBytes / sizeof(T);
+
+	prefixRows = capacity;
+	prefix = capacity > 0 ? allocateRows(capacity) : nullptr;
+
+	segmentShift = floorLog2(std::max(capacity, minSegmentRows) - 1) + 1;
+
+	for (std::atomic<T*> &segment : segments) {
+		segment.store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+template<class T>
+RowStore<T>::RowStore(int width, T *rows, std::size_t count, std::size_t rowAlignment) : RowStore(width, std::size_t(0), rowAlignment) {
+	prefix = rows;
+	prefixRows = count;
+	ownsPrefix = false;
+	segmentShift = floorLog2(std::max(count, minSegmentRows) - 1) + 1;
+}
+
+template<class T>
+RowStore<T>::RowStore(RowStore &&other) {
+	for (std::atomic<T*> &segment : segments) {
+		segment.store(nullptr, std::memory_order_relaxed);
+	}
+
+	move(std::move(other));
+}
+
+template<class T>
+RowStore<T>& RowStore<T>::operator=(RowStore &&other) {
+	if (this != &other) {
+		release();
+		move(std::move(other));
+	}
+
+	return *this;
+}
+
+template<class T>
+RowStore<T>::~RowStore() {
+	release();
+}
+
+template<class T>
+void RowStore<T>::move(RowStore &&other) {
+	width = other.width;
+	stride = other.stride;
+	prefix = other.prefix;
+	prefixRows = other.prefixRows;
+	ownsPrefix = other.ownsPrefix;
+	segmentShift = other.segmentShift;
+
+	for (int i = 0; i < maxSegments; ++i) {
+		segments[i].store(other.segments[i].exchange(nullptr));
+	}
+
+	other.prefix = nullptr;
+	other.prefixRows = 0;
+}
+
+template<class T>
+T* RowStore<T>::allocateRows(std::size_t rows) {
+	T *data = static_cast<T*>(alignedAlloc(rows * stride * sizeof(T), cacheLineSize));
+
+	if (!std::is_trivially_default_constructible<T>::value) {
+		for (std::size_t i = 0; i < rows * stride; ++i) {
+			new (data + i) T();
+		}
+	}
+
+	return data;
+}
+
+template<class T>
+void RowStore<T>::freeRows(T *data, std::size_t rows) {
+	if (!data) {
+		return;
+	}
+
+	if (!std::is_trivially_destructible<T>::value) {
+		for (std::size_t i = 0; i < rows * stride; ++i) {
+			data[i].~T();
+		}
+	}
+
+	alignedFree(data);
+}
+
+template<class T>
+void RowStore<T>::grow(int segment) {
+	std::unique_lock<std::mutex> lock(growMutex);
+
+	for (int i = 0; i <= segment; ++i) {
+		if (!segments[i].load(std::memory_order_relaxed)) {
+			segments[i].store(allocateRows(std::size_t(1) << (segmentShift + i)), std::memory_order_release);
+		}
+	}
+}
+
+template<class T>
+void RowStore<T>::release() {
+	if (ownsPrefix) {
+		freeRows(prefix, prefixRows);
+	}
+
+	prefix = nullptr;
+	prefixRows = 0;
+
+	for (int i = 0; i < maxSegments; ++i) {
+		T *segment = segments[i].exchange(nullptr);
+
+		if (segment) {
+			freeRows(segment, std::size_t(1) << (segmentShift + i));
+		}
+	}
+}
+
+template<class T>
+T* RowStore<T>::allocate(std::size_t id) {
+	if (id >= prefixRows) {
+		int segment;
+		std::size_t offset;
+		locate(id, segment, offset);
+
+		if (!segments[segment].load(std::memory_order_acquire)) {
+			grow(segment);
+		}
+	}
+
+	return row(id);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "../distance.h"
+
+// Compares every distance kernel supported by the CPU with the scalar reference
+// for common and odd descriptor sizes, including sizes with tails shorter than a vector.
+int main() {
+	std::vector<int> sizes;
+
+	for (int size = 1; size <= 80; ++size) {
+		sizes.push_back(size);
+	}
+
+	for (int size : {96, 100, 127, 128, 129, 255, 256, 257, 511, 512, 513, 1000}) {
+		sizes.push_back(size);
+	}
+
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<float> dist(-10, 10);
+	int failedCount = 0;
+
+	for (int size : sizes) {
+		std::vector<KernelInfo> kernels = l2Kernels(size);
+		KernelInfo reference = kernels.front();
+
+		// Extra value lets descriptors start at an offset, so unaligned loads are checked too.
+		std::vector<Scalar> a(size + 1);
+		std::vector<Scalar> b(size + 1);
+
+		for (int round = 0; round < 20; ++round) {
+			for (int i = 0; i <= size; ++i) {
+				a[i] = dist(gen);
+				b[i] = round % 5 == 0 ? a[i] : dist(gen);
+			}
+
+			int offset = round % 2;
+			Scalar expected = reference.kernel(a.data() + offset, b.data() + offset, size);
+
+			for (const KernelInfo &kernel : kernels) {
+				Scalar actual = kernel.kernel(a.data() + offset, b.data() + offset, size);
+
+				// Kernels sum in different orders, the error of float sums grows with the size.
+				double tolerance = 1e-6 * size * std::abs(expected) + 1e-6;
+
+				if (!(std::abs(actual - expected) <= tolerance)) {
+					std::cerr << kernel.name << " kernel, size " << size << ": " << actual << " instead of " << expected << std::endl;
+					++failedCount;
+				}
+			}
+		}
+	}
+
+	std::cout << "Checked kernels:";
+
+	for (const KernelInfo &kernel : l2Kernels(0)) {
+		std::cout << " " << kernel.name;
+	}
+
+	std::cout << std::endl;
+
+	if (failedCount > 0) {
+		std::cerr << failedCount << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "All checks passed" << std::endl;
+
+	return 0;
+}
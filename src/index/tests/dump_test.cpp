@@ -0,0 +1,326 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+
+#include "../index.h"
+
+static const int descriptorSize = 16;
+static const int nodesCount = 300;
+static const int neighboursCount = 8;
+static const int M = 16;
+static const int M0 = 32;
+
+static int failedCount = 0;
+
+static void check(bool condition, const std::string &message) {
+	if (!condition) {
+		std::cerr << message << std::endl;
+		++failedCount;
+	}
+}
+
+static std::vector<Scalar> randomDescriptor(std::mt19937 &gen) {
+	std::uniform_real_distribution<float> dist(0, 1);
+	std::vector<Scalar> descriptor(descriptorSize);
+
+	for (Scalar &value : descriptor) {
+		value = dist(gen);
+	}
+
+	return descriptor;
+}
+
+static double squaredDistance(const std::vector<Scalar> &a, const std::vector<Scalar> &b) {
+	double sum = 0;
+
+	for (int i = 0; i < descriptorSize; ++i) {
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
+	}
+
+	return sum;
+}
+
+// Text dump in the format of older versions: header, node lines, then link lines of layer 0 to the nearest nodes.
+// An overfull dump links node 0 to M0 + 1 nodes on layer 0 and to M + 1 nodes on layer 1, which is above the maximum.
+static void writeTextDump(const std::string &path, const std::string &levelFields, const std::vector<std::vector<Scalar>> &data, bool overfull = false) {
+	std::ofstream file(path);
+
+	file << nodesCount << "," << nodesCount - 1 << ",0," << descriptorSize << "," << M << "," << M0 << ",100,10" << levelFields << "\n";
+
+	for (int id = 0; id < nodesCount; ++id) {
+		file << id << ",old" << id;
+
+		for (Scalar value : data[id]) {
+			file << "," << value;
+		}
+
+		file << (overfull && id <= M + 1 ? ",2\n" : ",1\n");
+	}
+
+	for (int id = 0; id < nodesCount; ++id) {
+		std::vector<std::pair<double, int>> others;
+
+		for (int other = 0; other < nodesCount; ++other) {
+			if (other != id) {
+				others.emplace_back(squaredDistance(data[id], data[other]), other);
+			}
+		}
+
+		int count = overfull && id == 0 ? M0 + 1 : neighboursCount;
+
+		std::partial_sort(others.begin(), others.begin() + count, others.end());
+		file << id << ",0," << count;
+
+		for (int i = 0; i < count; ++i) {
+			file << "," << others[i].second;
+		}
+
+		file << "\n";
+	}
+
+	if (overfull) {
+		file << "0,1," << M + 1;
+
+		for (int id = 1; id <= M + 1; ++id) {
+			file << "," << id;
+		}
+
+		file << "\n";
+
+		for (int id = 1; id <= M + 1; ++id) {
+			file << id << ",1,1,0\n";
+		}
+	}
+}
+
+static std::vector<char> readFile(const std::string &path) {
+	std::ifstream file(path, std::ios::binary);
+	return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Checks, that link blocks of a binary dump hold at most M0 links on layer 0 and M links on upper layers.
+static void checkLinkCounts(const std::string &path, const std::string &stage) {
+	std::vector<char> data = readFile(path);
+	const DumpHeader &header = *reinterpret_cast<const DumpHeader*>(data.data());
+
+	const std::int32_t *links0 = reinterpret_cast<const std::int32_t*>(data.data() + header.links0Offset);
+	const std::int32_t *levels = reinterpret_cast<const std::int32_t*>(data.data() + header.levelsOffset);
+	const std::int32_t *upperLinks = reinterpret_cast<const std::int32_t*>(data.data() + header.upperLinksOffset);
+	int overfullCount = 0;
+
+	for (int id = 0; id < header.nodesCount; ++id) {
+		overfullCount += links0[id * (header.M0 + 2)] > header.M0;
+
+		for (int layer = 1; layer <= levels[id]; ++layer) {
+			overfullCount += upperLinks[0] > header.M;
+			upperLinks += header.M + 2;
+		}
+	}
+
+	check(overfullCount == 0, stage + ": " + std::to_string(overfullCount) + " link blocks over the maximum");
+}
+
+// Inserts new images and checks, that each of them is found as its own nearest image.
+static void checkInserts(Index &index, std::mt19937 &gen, const std::string &prefix, const std::string &stage) {
+	std::vector<std::vector<Scalar>> inserted;
+
+	for (int i = 0; i < nodesCount; ++i) {
+		inserted.push_back(randomDescriptor(gen));
+		index.insert(prefix + std::to_string(i), inserted.back());
+	}
+
+	int foundCount = 0;
+
+	for (int i = 0; i < nodesCount; ++i) {
+		std::vector<SearchResult> results = index.search(inserted[i], SearchParams(1, 100));
+		foundCount += !results.empty() && results.front().name == prefix + std::to_string(i);
+	}
+
+	check(foundCount == nodesCount, stage + ": " + std::to_string(foundCount) + " of " + std::to_string(nodesCount) + " inserted images found");
+}
+
+static DumpHeader readHeader(const std::string &path) {
+	DumpHeader header = {};
+	std::ifstream file(path, std::ios::binary);
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+	return header;
+}
+
+static void writeHeader(const std::string &path, const DumpHeader &header) {
+	std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+static bool loads(const std::string &path) {
+	try {
+		Index index(path);
+		return true;
+	} catch (const std::runtime_error&) {
+		return false;
+	}
+}
+
+// Loads text dumps with and without level generation parameters, inserts into them and into their binary conversions.
+int main(int argc, char **argv) {
+	std::string path = std::string(argv[0]) + ".dump";
+	std::string binaryPath = path + ".bin";
+
+	std::mt19937 gen(1);
+	std::vector<std::vector<Scalar>> data;
+
+	for (int i = 0; i < nodesCount; ++i) {
+		data.push_back(randomDescriptor(gen));
+	}
+
+	// Dumps without level parameters take them from settings, which differ from the defaults to tell them apart.
+	Settings settings;
+	settings.mL = 0.25;
+	settings.keepPrunedConnections = false;
+
+	struct LevelParameters {
+		std::string fields;
+		double mL;
+		bool keepPrunedConnections;
+	};
+
+	for (const LevelParameters &level : {LevelParameters{",0.360674,1", 0.360674, true}, LevelParameters{",0.5,0", 0.5, false}, LevelParameters{"", 0.25, false}}) {
+		std::string format = level.fields.empty() ? "text dump without level parameters" : "text dump with level parameters " + level.fields;
+
+		writeTextDump(path, level.fields, data);
+
+		{
+			Index index(path, settings);
+			check(index.getSize() == nodesCount, format + ": wrong size");
+			checkInserts(index, gen, "text", format);
+
+			index.save(binaryPath);
+		}
+
+		DumpHeader header = readHeader(binaryPath);
+		check(std::abs(header.mL - level.mL) < 1e-12 && header.keepPrunedConnections == level.keepPrunedConnections,
+			format + ": saved with mL " + std::to_string(header.mL) + ", keepPrunedConnections " + std::to_string(header.keepPrunedConnections));
+
+		Index binaryIndex(binaryPath);
+		check(binaryIndex.getSize() == 2 * nodesCount, format + ": wrong size of binary dump");
+		checkInserts(binaryIndex, gen, "binary", format + ", converted");
+	}
+
+	// Inserts next to node 0 add links to its blocks, which have to stay within their rows.
+	{
+		writeTextDump(path, ",2,1", data, true);
+
+		{
+			Index index(path);
+			std::normal_distribution<float> noise(0, 0.001f);
+
+			for (int i = 0; i < nodesCount; ++i) {
+				std::vector<Scalar> descriptor = data[0];
+
+				for (Scalar &value : descriptor) {
+					value += noise(gen);
+				}
+
+				index.insert("near" + std::to_string(i), descriptor);
+			}
+
+			index.save(binaryPath);
+		}
+
+		checkLinkCounts(binaryPath, "overfull text dump");
+
+		Index binaryIndex(binaryPath);
+		checkInserts(binaryIndex, gen, "overfull", "overfull text dump, converted");
+	}
+
+	// Inserts after a snapshot prune links of its nodes, which are saved as they were at the snapshot.
+	// The dump is the same as the one saved before the inserts, replayed inserts are found after reload.
+	{
+		std::string snapshotPath = path + ".snapshot";
+		std::vector<std::vector<Scalar>> later;
+		std::normal_distribution<float> noise(0, 0.001f);
+
+		for (int i = 0; i < nodesCount; ++i) {
+			later.push_back(data[i]);
+
+			for (Scalar &value : later.back()) {
+				value += noise(gen);
+			}
+		}
+
+		{
+			Index index(descriptorSize);
+
+			for (int i = 0; i < nodesCount; ++i) {
+				index.insert(std::to_string(i), data[i]);
+			}
+
+			index.save(binaryPath);
+			Index::Snapshot snapshot = index.snapshot(index.getLogGeneration());
+
+			for (int i = 0; i < nodesCount; ++i) {
+				index.insert("later" + std::to_string(i), later[i]);
+			}
+
+			index.save(snapshotPath, snapshot);
+		}
+
+		check(readFile(snapshotPath) == readFile(binaryPath), "snapshot differs from the dump saved before later inserts");
+
+		Index index(snapshotPath);
+		check(index.getSize() == nodesCount, "snapshot: wrong size");
+
+		for (int i = 0; i < nodesCount; ++i) {
+			index.insert("later" + std::to_string(i), later[i]);
+		}
+
+		int foundCount = 0;
+
+		for (int i = 0; i < nodesCount; ++i) {
+			std::vector<SearchResult> results = index.search(data[i], SearchParams(1, 100));
+			foundCount += !results.empty() && results.front().name == std::to_string(i);
+
+			results = index.search(later[i], SearchParams(1, 100));
+			foundCount += !results.empty() && results.front().name == "later" + std::to_string(i);
+		}
+
+		check(foundCount == 2 * nodesCount, "snapshot: " + std::to_string(foundCount) + " of " + std::to_string(2 * nodesCount) + " images found after replay");
+
+		std::remove(snapshotPath.c_str());
+	}
+
+	for (const std::string &levelFields : {",0,1", ",-1,1", ",1e400,1", ",0.5", ",0.5,1,2"}) {
+		writeTextDump(path, levelFields, data);
+		check(!loads(path), std::string("text dump with level parameters ") + levelFields + " is loaded");
+	}
+
+	DumpHeader header = readHeader(binaryPath);
+
+	for (double mL : {0.0, -1.0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity()}) {
+		header.mL = mL;
+		writeHeader(binaryPath, header);
+
+		check(!loads(binaryPath), "binary dump with mL " + std::to_string(mL) + " is loaded");
+	}
+
+	std::remove(path.c_str());
+	std::remove(binaryPath.c_str());
+
+	if (failedCount > 0) {
+		std::cerr << failedCount << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "All checks passed" << std::endl;
+
+	return 0;
+}
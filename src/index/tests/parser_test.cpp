@@ -0,0 +1,130 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <stdexcept>
+
+#include "../parser.h"
+
+static int failedCount = 0;
+
+static void check(bool condition, const std::string &message) {
+	if (!condition) {
+		std::cerr << message << std::endl;
+		++failedCount;
+	}
+}
+
+// Returns the error message of parseDescriptor, empty if the body is parsed.
+static std::string parse(const std::string &body, int descriptorSize, std::vector<Scalar> &descriptor) {
+	try {
+		FieldReader reader(body.data(), body.data() + body.size());
+		descriptor = parseDescriptor(reader, descriptorSize);
+	} catch (const std::runtime_error &e) {
+		return e.what();
+	}
+
+	return std::string();
+}
+
+// Returns the error message of parsing and checking search parameters, empty if they are accepted.
+static std::string checkParams(Index &index, const RequestParams &params, SearchParams &searchParams) {
+	try {
+		searchParams = parseSearchParams(params);
+		index.checkSearchParams(searchParams);
+	} catch (const std::runtime_error &e) {
+		return e.what();
+	}
+
+	return std::string();
+}
+
+static void checkParamsError(Index &index, const RequestParams &params, const std::string &expected) {
+	SearchParams searchParams;
+	std::string error = checkParams(index, params, searchParams);
+
+	check(error.substr(0, expected.size()) == expected, "parameters give \"" + error + "\" instead of \"" + expected + "...\"");
+}
+
+static void checkValues(const std::string &body, const std::vector<Scalar> &expected) {
+	std::vector<Scalar> descriptor;
+	std::string error = parse(body, expected.size(), descriptor);
+
+	check(error.empty() && descriptor == expected, "\"" + body + "\" isn't parsed as expected: " + error);
+}
+
+static void checkError(const std::string &body, int descriptorSize, const std::string &expected) {
+	std::vector<Scalar> descriptor;
+	std::string error = parse(body, descriptorSize, descriptor);
+
+	check(error == expected, "\"" + body + "\" gives \"" + error + "\" instead of \"" + expected + "\"");
+}
+
+int main() {
+	checkValues("1,-2.5,+3e2,4E-1", {1, -2.5f, 300, 0.4f});
+	checkValues(" 0.125 , 7 \r\n", {0.125f, 7});
+
+	// Zero mantissa with an exponent beyond double range.
+	checkValues("0e400,0.000e+99999,-0e400", {0, 0, 0});
+	checkValues("1e-400", {0});
+
+	checkError("1e400", 1, "Value is out of range");
+	checkError("1e39", 1, "Value is out of range");
+	checkError("nan", 1, "Invalid value");
+	checkError("inf", 1, "Invalid value");
+	checkError("1,abc", 2, "Invalid value");
+	checkError("1.5e", 1, "Invalid value");
+	checkError("1,2", 3, "Incorrect descriptor size");
+	checkError("1,2,3", 2, "Incorrect descriptor size");
+
+	Index index(4);
+	SearchParams searchParams;
+
+	// ef = 0 searches with efSearch, maxEvaluations = 0 doesn't limit evaluations.
+	std::string error = checkParams(index, {{"ef", "0"}, {"maxEvaluations", "0"}}, searchParams);
+	check(error.empty() && searchParams.k == 1 && searchParams.ef == 0 && searchParams.maxEvaluations == 0, "ef=0&maxEvaluations=0 isn't accepted: " + error);
+
+	error = checkParams(index, {{"k", "5"}, {"ef", "20"}, {"maxEvaluations", "300"}}, searchParams);
+	check(error.empty() && searchParams.k == 5 && searchParams.ef == 20 && searchParams.maxEvaluations == 300, "k=5&ef=20&maxEvaluations=300 isn't accepted: " + error);
+
+	checkParamsError(index, {{"k", "0"}}, "Invalid k");
+	checkParamsError(index, {{"ef", "-1"}}, "Invalid ef");
+	checkParamsError(index, {{"maxEvaluations", "-1"}}, "Invalid maxEvaluations");
+	checkParamsError(index, {{"ef", "1x"}}, "Invalid ef");
+	checkParamsError(index, {{"k", "1001"}}, "k should be between 1 and 1000");
+	checkParamsError(index, {{"ef", "1001"}}, "ef should be between 0 and 1000");
+
+	// Values rounded to float are the same as with strtod.
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<double> mantissas(-10, 10);
+	std::uniform_int_distribution<int> exponents(-30, 30);
+	int mismatchesCount = 0;
+
+	for (int i = 0; i < 100000; ++i) {
+		char text[64];
+		std::snprintf(text, sizeof(text), i % 2 ? "%.9g" : "%.17g", mantissas(gen) * std::pow(10.0, exponents(gen)));
+
+		std::vector<Scalar> descriptor;
+		std::string error = parse(text, 1, descriptor);
+
+		if (!error.empty() || descriptor.front() != static_cast<Scalar>(std::strtod(text, nullptr))) {
+			if (++mismatchesCount <= 10) {
+				std::cerr << text << " is parsed differently from strtod" << std::endl;
+			}
+		}
+	}
+
+	check(mismatchesCount == 0, std::to_string(mismatchesCount) + " values differ from strtod");
+
+	if (failedCount > 0) {
+		std::cerr << failedCount << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "All checks passed" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#include "../index.h"
+
+// Removes, repairs and reinserts nodes while searches run, so released ids are reused under running searches.
+// Every result has to carry the descriptor and distance of its own name, reinserted nodes have to be found again.
+
+static const int descriptorSize = 16;
+static const int nodesCount = 2000;
+static const int removedCount = 200;
+static const int roundsCount = 50;
+static const int searchThreads = 4;
+
+static std::atomic<int> failedCount{0};
+
+static void fail(const std::string &message) {
+	if (failedCount++ < 10) {
+		std::cerr << message << std::endl;
+	}
+}
+
+static double l2(const std::vector<Scalar> &a, const std::vector<Scalar> &b) {
+	double sum = 0;
+
+	for (int i = 0; i < descriptorSize; ++i) {
+		sum += (a[i] - b[i]) * (a[i] - b[i]);
+	}
+
+	return std::sqrt(sum);
+}
+
+static void checkResults(const std::vector<Scalar> &query, const std::vector<SearchResult> &results,
+	const std::unordered_map<std::string, std::vector<Scalar>> &data) {
+	for (const SearchResult &result : results) {
+		auto item = data.find(result.name);
+
+		if (item == data.end()) {
+			fail("Unknown name " + result.name);
+		} else if (result.descriptor != item->second) {
+			fail("Descriptor of another node under " + result.name);
+		} else if (std::abs(result.distance - l2(query, item->second)) > 1e-3) {
+			fail("Distance of another node under " + result.name);
+		}
+	}
+}
+
+int main() {
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<float> dist(0, 1);
+	std::vector<std::string> names(nodesCount);
+	std::unordered_map<std::string, std::vector<Scalar>> data;
+
+	for (int i = 0; i < nodesCount; ++i) {
+		names[i] = "n" + std::to_string(i);
+		std::vector<Scalar> &descriptor = data[names[i]];
+
+		for (int j = 0; j < descriptorSize; ++j) {
+			descriptor.push_back(dist(gen));
+		}
+	}
+
+	Index index(descriptorSize);
+
+	for (const std::string &name : names) {
+		index.insert(name, data.at(name));
+	}
+
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> searchers;
+
+	for (int t = 0; t < searchThreads; ++t) {
+		searchers.emplace_back([&, t]() {
+			std::mt19937 queryGen(t + 2);
+			std::uniform_real_distribution<float> queryDist(0, 1);
+			std::vector<Scalar> query(descriptorSize);
+			SearchParams params(10, 200);
+			params.withDescriptors = true;
+
+			while (!stop) {
+				for (Scalar &value : query) {
+					value = queryDist(queryGen);
+				}
+
+				checkResults(query, index.search(query, params), data);
+			}
+		});
+	}
+
+	int maxSize = index.getSize();
+	int missedCount = 0;
+
+	for (int round = 0; round < roundsCount; ++round) {
+		std::shuffle(names.begin(), names.end(), gen);
+		std::vector<std::string> removed(names.begin(), names.begin() + removedCount);
+
+		for (const std::string &name : removed) {
+			index.remove(name);
+		}
+
+		for (const std::string &name : removed) {
+			std::vector<SearchResult> results = index.search(data.at(name), SearchParams(1, 50));
+
+			if (!results.empty() && results.front().name == name) {
+				fail("Removed " + name + " is found");
+			}
+		}
+
+		// Removed ids are pending after the first repair and released after the second one.
+		index.repair();
+		index.repair();
+
+		for (const std::string &name : removed) {
+			index.insert(name, data.at(name));
+		}
+
+		for (const std::string &name : removed) {
+			std::vector<SearchResult> results = index.search(data.at(name), SearchParams(1, 50));
+
+			if (results.empty() || results.front().name != name) {
+				++missedCount;
+			}
+		}
+
+		maxSize = std::max(maxSize, index.getSize());
+	}
+
+	stop = true;
+
+	for (std::thread &searcher : searchers) {
+		searcher.join();
+	}
+
+	if (maxSize > nodesCount + removedCount) {
+		fail("Released ids aren't reused: " + std::to_string(maxSize) + " ids for " + std::to_string(nodesCount) + " nodes");
+	}
+
+	if (missedCount > roundsCount * removedCount / 100) {
+		fail(std::to_string(missedCount) + " reinserted nodes aren't found");
+	}
+
+	std::cout << roundsCount << " rounds of " << removedCount << " reinserted nodes, " << maxSize << " ids, "
+		<< missedCount << " missed" << std::endl;
+
+	if (failedCount > 0) {
+		std::cerr << failedCount << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "All checks passed" << std::endl;
+
+	return 0;
+}
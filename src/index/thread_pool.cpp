@@ -1,61 +1,36 @@
 #include <vector>
-#include <queue>
+#include <deque>
+#include <memory>
 #include <functional>
+#include <exception>
+#include <algorithm>
 #include <thread>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
 
 #include "thread_pool.h"
 
-void ThreadPool::DoubleLock::lock() {
-	if (!isLocked) {
-		std::lock(mutex1, mutex2);
+struct ThreadPool::Batch {
+	const RangeAction &action;
+	int remaining;
+	std::exception_ptr error;
+	std::atomic<bool> isFailed{false};
 
-		isLocked = true;
-	}
-}
+	std::mutex mutex;
+	std::condition_variable doneCV;
 
-void ThreadPool::DoubleLock::unlock() {
-	if (isLocked) {
-		mutex1.unlock();
-		mutex2.unlock();
-
-		isLocked = false;
-	}
-}
+	Batch(const RangeAction &action, int remaining) : action(action), remaining(remaining) {}
+};
 
 void ThreadPool::init(int threadCount) {
 	for (int i = 0; i < threadCount; ++i) {
-		workers.push_back(std::thread([this]() {
-			while (true) {
-				std::function<void()> task;
-
-				DoubleLock taskLock(runningMutex, tasksMutex);
-
-				while (isRunning && tasks.empty()) {
-					taskCV.wait(taskLock);
-				}
-
-				if (!isRunning) {
-					break;
-				}
-
-				task = std::move(tasks.front());
-				tasks.pop();
-
-				taskLock.unlock();
-
-				std::unique_lock<std::mutex> workingLock(workingMutex);
-				working++;
-				workingLock.unlock();
-
-				task();
-
-				workingLock.lock();
-				working--;
-				workingLock.unlock();
+		queues.emplace_back(new Queue());
+	}
 
-				poolCV.notify_one();
-			}
+	for (int i = 0; i < threadCount; ++i) {
+		workers.push_back(std::thread([this, i]() {
+			work(i);
 		}));
 	}
 }
@@ -66,47 +41,152 @@ ThreadPool::ThreadPool() {
 }
 
 ThreadPool::ThreadPool(int threadCount) {
-	init(threadCount);
+	init(std::max(threadCount, 1));
 }
 
 ThreadPool::~ThreadPool() {
-	wait();
-
-	std::unique_lock<std::mutex> lock(runningMutex);
+	std::unique_lock<std::mutex> lock(sleepMutex);
 	isRunning = false;
 	lock.unlock();
 
-	taskCV.notify_all();
+	sleepCV.notify_all();
 
 	for (std::thread &thread : workers) {
 		thread.join();
 	}
 }
 
-ThreadPool::ThreadPool(ThreadPool &&other) {
-	other.wait();
-	init(other.workers.size());
+void ThreadPool::work(int queue) {
+	Task task;
+
+	while (true) {
+		if (takeTask(queue, task)) {
+			runTask(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+
+		sleepCV.wait(lock, [this]() {
+			return queuedCount > 0 || !isRunning;
+		});
+
+		if (!isRunning) {
+			break;
+		}
+	}
 }
 
-ThreadPool& ThreadPool::operator=(ThreadPool &&other) {
-	other.wait();
-	init(other.workers.size());
+bool ThreadPool::takeTask(int queue, Task &task) {
+	if (queuedCount == 0) {
+		return false;
+	}
+
+	if (queue >= 0) {
+		Queue &own = *queues[queue];
+		std::unique_lock<std::mutex> lock(own.mutex);
+
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			--queuedCount;
+
+			return true;
+		}
+	}
+
+	int start = std::max(queue, 0);
+
+	for (int i = 1; i <= queues.size(); ++i) {
+		Queue &victim = *queues[(start + i) % queues.size()];
+		std::unique_lock<std::mutex> lock(victim.mutex);
 
-	return *this;
+		if (!victim.tasks.empty()) {
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			--queuedCount;
+
+			return true;
+		}
+	}
+
+	return false;
 }
 
-void ThreadPool::enqueu(std::function<void()> task) {
-	std::unique_lock<std::mutex> lock(tasksMutex);
-	tasks.push(task);
-	lock.unlock();
+void ThreadPool::runTask(const Task &task) {
+	Batch &batch = *task.batch;
+
+	// Ranges of a failed batch are skipped, its error is thrown anyway.
+	if (!batch.isFailed) {
+		try {
+			batch.action(task.begin, task.end);
+		} catch (...) {
+			std::unique_lock<std::mutex> lock(batch.mutex);
 
-	taskCV.notify_one();
+			if (!batch.error) {
+				batch.error = std::current_exception();
+			}
+
+			batch.isFailed = true;
+		}
+	}
+
+	// The waiting thread may destroy the batch as soon as the mutex is released.
+	std::unique_lock<std::mutex> lock(batch.mutex);
+
+	if (--batch.remaining == 0) {
+		batch.doneCV.notify_all();
+	}
 }
 
-void ThreadPool::wait() {
-	DoubleLock lock(tasksMutex, workingMutex);
+void ThreadPool::parallelFor(int count, const RangeAction &action, int grain) {
+	if (count <= 0) {
+		return;
+	}
+
+	if (grain <= 0) {
+		grain = std::max(1, count / (getSize() * 4));
+	}
+
+	int tasksCount = (count + grain - 1) / grain;
+	Batch batch(action, tasksCount);
+	unsigned first = nextQueue.fetch_add(tasksCount);
+
+	// Ranges are dealt round-robin, so every worker starts with its own share.
+	for (int i = 0; i < queues.size() && i < tasksCount; ++i) {
+		Queue &queue = *queues[(first + i) % queues.size()];
+		std::unique_lock<std::mutex> lock(queue.mutex);
+
+		for (int task = i; task < tasksCount; task += queues.size()) {
+			queue.tasks.push_back({&batch, task * grain, std::min(count, (task + 1) * grain)});
+		}
+	}
+
+	std::unique_lock<std::mutex> sleepLock(sleepMutex);
+	queuedCount += tasksCount;
+	sleepLock.unlock();
+
+	sleepCV.notify_all();
+
+	Task task;
+	std::unique_lock<std::mutex> lock(batch.mutex);
+
+	while (batch.remaining > 0) {
+		lock.unlock();
+
+		if (takeTask(-1, task)) {
+			runTask(task);
+			lock.lock();
+		} else {
+			lock.lock();
+
+			batch.doneCV.wait(lock, [&batch]() {
+				return batch.remaining == 0;
+			});
+		}
+	}
 
-	while (tasks.size() > 0 || working > 0) {
-		poolCV.wait(lock);
+	if (batch.error) {
+		std::rethrow_exception(batch.error);
 	}
 }
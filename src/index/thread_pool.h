@@ -2,52 +2,54 @@
 #define THREAD_POOL_H
 
 #include <vector>
-#include <queue>
+#include <deque>
+#include <memory>
 #include <functional>
-#include <utility>
+#include <exception>
 #include <thread>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 
+// Work-stealing pool. Each worker takes tasks from the back of its own deque and steals from the front of others,
+// so workers contend only when one of them runs out of work.
 class ThreadPool {
-	class DoubleLock {
-		std::mutex &mutex1;
-		std::mutex &mutex2;
-
-		bool isLocked = false;
-
-	public:
-
-		DoubleLock(std::mutex &mutex1, std::mutex &mutex2) : mutex1(mutex1), mutex2(mutex2) {
-			lock();
-		};
+public:
+	// Handles indices [begin, end) of a parallelFor range.
+	using RangeAction = std::function<void(int begin, int end)>;
 
-		~DoubleLock() {
-			unlock();
-		}
+private:
+	struct Batch;
 
-		DoubleLock(const DoubleLock&) = delete;
-		DoubleLock& operator=(const DoubleLock&) = delete;
+	// Part of a parallelFor range, tasks only refer to the action of their batch, so they aren't allocated.
+	struct Task {
+		Batch *batch;
+		int begin;
+		int end;
+	};
 
-		void lock();
-		void unlock();
+	struct Queue {
+		std::deque<Task> tasks;
+		std::mutex mutex;
 	};
 
 	int defaultThreadCount = 4;
 
+	std::vector<std::unique_ptr<Queue>> queues;
 	std::vector<std::thread> workers;
-	std::queue<std::function<void()>> tasks;
+	std::atomic<unsigned> nextQueue{0};
 
+	std::atomic<int> queuedCount{0};
 	bool isRunning = true;
-	int working = 0;
-
-	std::mutex tasksMutex;
-	std::mutex runningMutex;
-	std::mutex workingMutex;
-	std::condition_variable_any taskCV;
-	std::condition_variable_any poolCV;
+	std::mutex sleepMutex;
+	std::condition_variable sleepCV;
 
 	void init(int threadCount);
+	void work(int queue);
+
+	// queue = -1 only steals.
+	bool takeTask(int queue, Task &task);
+	void runTask(const Task &task);
 
 public:
 	ThreadPool();
@@ -57,12 +59,14 @@ public:
 	ThreadPool(const ThreadPool &other) = delete;
 	ThreadPool& operator=(const ThreadPool &other) = delete;
 
-	ThreadPool(ThreadPool &&other);
-	ThreadPool& operator=(ThreadPool &&other);
-
-	void enqueu(std::function<void()> task);
+	int getSize() const {
+		return workers.size();
+	}
 
-	void wait();
+	// Splits [0, count) into ranges run by the pool and waits for them, the calling thread helps meanwhile.
+	// Concurrent calls wait only for their own ranges. Rethrows the first exception of the action.
+	// grain = 0 picks a range size, that gives each worker several ranges.
+	void parallelFor(int count, const RangeAction &action, int grain = 0);
 };
 
 #endif